@@ -0,0 +1,165 @@
+//
+// Created by kihiro on 5/11/20.
+//
+
+#ifndef DG_BASIS_H
+#define DG_BASIS_H
+
+#include <cmath>
+#include <vector>
+#include "types.h"
+
+/*! \brief Evaluate the 1D Lagrange basis on equispaced nodes of [0, 1]
+ *
+ * @param order polynomial order, the basis has order+1 functions
+ * @param x evaluation point
+ * @param phi values of the basis functions (size order+1)
+ */
+inline void lagrange_1d(const int order, const rtype x, rtype *phi) {
+    for (int i=0; i<=order; i++) {
+        phi[i] = 1.;
+        if (order == 0) continue;
+        rtype xi = (rtype) i / (rtype) order;
+        for (int j=0; j<=order; j++) {
+            if (j == i) continue;
+            rtype xj = (rtype) j / (rtype) order;
+            phi[i] *= (x - xj) / (xi - xj);
+        }
+    }
+}
+
+/*! \brief Evaluate the derivative of the 1D Lagrange basis on equispaced nodes of [0, 1]
+ *
+ * @param order polynomial order, the basis has order+1 functions
+ * @param x evaluation point
+ * @param dphi derivatives of the basis functions (size order+1)
+ */
+inline void lagrange_1d_deriv(const int order, const rtype x, rtype *dphi) {
+    for (int i=0; i<=order; i++) {
+        dphi[i] = 0.;
+        rtype xi = (rtype) i / (rtype) order;
+        for (int k=0; k<=order; k++) {
+            if (k == i) continue;
+            rtype xk = (rtype) k / (rtype) order;
+            rtype prod = 1. / (xi - xk);
+            for (int j=0; j<=order; j++) {
+                if (j == i || j == k) continue;
+                rtype xj = (rtype) j / (rtype) order;
+                prod *= (x - xj) / (xi - xj);
+            }
+            dphi[i] += prod;
+        }
+    }
+}
+
+/*! \brief Gauss-Legendre quadrature on [0, 1]
+ *
+ * Roots of the Legendre polynomial found by Newton iterations.
+ *
+ * @param n number of points, exact for polynomials of degree 2n-1
+ * @param x quadrature points (size n)
+ * @param w quadrature weights (size n), they sum to 1
+ */
+inline void gauss_legendre(const int n, rtype *x, rtype *w) {
+    for (int i=0; i<n; i++) {
+        double root = cos(M_PI*(i + 0.75)/(n + 0.5));
+        double dp = 1.;
+        for (int it=0; it<100; it++) {
+            // three-term recurrence for P_n and its derivative
+            double p0 = 1., p1 = root;
+            for (int k=2; k<=n; k++) {
+                double p2 = ((2*k - 1)*root*p1 - (k - 1)*p0) / k;
+                p0 = p1;
+                p1 = p2;
+            }
+            dp = n*(root*p1 - p0) / (root*root - 1.);
+            double delta = p1 / dp;
+            root -= delta;
+            if (fabs(delta) < 1e-15) break;
+        }
+        // map from [-1, 1] to [0, 1], points in increasing order
+        x[n-1-i] = (rtype) (0.5*(root + 1.));
+        w[n-1-i] = (rtype) (1. / ((1. - root*root)*dp*dp));
+    }
+}
+
+/*! \brief 1D interpolation from the order pc Lagrange basis to the order pf nodes
+ *
+ * @param pf fine order, at least 1
+ * @param pc coarse order
+ * @param I interpolation matrix, I[i*(pc+1) + j] is coarse function j at fine node i
+ */
+inline void interpolation_1d(const int pf, const int pc, rtype *I) {
+    std::vector<rtype> phi(pc+1);
+    for (int i=0; i<=pf; i++) {
+        lagrange_1d(pc, (rtype) i / (rtype) pf, phi.data());
+        for (int j=0; j<=pc; j++) I[i*(pc+1) + j] = phi[j];
+    }
+}
+
+/*! \brief 1D L2 projection from the order pf Lagrange basis to the order pc one
+ *
+ * P = Mc^-1 B with the coarse mass matrix Mc and the mixed mass matrix B, both integrated exactly
+ * by Gauss-Legendre quadrature, Mc being inverted by Gauss-Jordan elimination.
+ *
+ * @param pf fine order
+ * @param pc coarse order
+ * @param P projection matrix, P[i*(pf+1) + j] is the weight of fine value j in coarse value i
+ */
+inline void l2_projection_1d(const int pf, const int pc, rtype *P) {
+    int nf = pf+1, nc = pc+1;
+    std::vector<rtype> xq(nf), wq(nf), phif(nf), phic(nc);
+    gauss_legendre(nf, xq.data(), wq.data());
+    // augmented system [Mc | B]
+    std::vector<double> A(nc*(nc+nf), 0.);
+    for (int q=0; q<nf; q++) {
+        lagrange_1d(pf, xq[q], phif.data());
+        lagrange_1d(pc, xq[q], phic.data());
+        for (int i=0; i<nc; i++) {
+            for (int j=0; j<nc; j++) A[i*(nc+nf) + j] += wq[q]*phic[i]*phic[j];
+            for (int j=0; j<nf; j++) A[i*(nc+nf) + nc + j] += wq[q]*phic[i]*phif[j];
+        }
+    }
+    // the mass matrix is symmetric positive definite, no pivoting needed
+    for (int k=0; k<nc; k++) {
+        double inv = 1. / A[k*(nc+nf) + k];
+        for (int j=0; j<nc+nf; j++) A[k*(nc+nf) + j] *= inv;
+        for (int i=0; i<nc; i++) {
+            if (i == k) continue;
+            double l = A[i*(nc+nf) + k];
+            for (int j=0; j<nc+nf; j++) A[i*(nc+nf) + j] -= l*A[k*(nc+nf) + j];
+        }
+    }
+    for (int i=0; i<nc; i++) {
+        for (int j=0; j<nf; j++) P[i*nf + j] = (rtype) A[i*(nc+nf) + nc + j];
+    }
+}
+
+/*! \brief Face ID of the face normal to a direction
+ *
+ * Quadrilateral faces: 0 y=0, 1 x=1, 2 y=1, 3 x=0. Hexahedron faces: 0 z=0, 1 y=0, 2 x=1, 3 y=1,
+ * 4 x=0, 5 z=1.
+ *
+ * @param dim number of spatial dimensions
+ * @param d direction
+ * @param side 0 for the face at the lower end, 1 for the face at the upper end
+ * @return face ID
+ */
+inline int face_id(const int dim, const int d, const int side) {
+    static const int quad_faces[2][2] = {{3, 1}, {0, 2}};
+    static const int hex_faces[3][2] = {{4, 2}, {1, 3}, {0, 5}};
+    return dim==3 ? hex_faces[d][side] : quad_faces[d][side];
+}
+
+/*! \brief Direction and side of a face, inverse of face_id
+ *
+ */
+inline void face_direction(const int dim, const int face, int &d, int &side) {
+    for (d=0; d<dim; d++) {
+        for (side=0; side<2; side++) {
+            if (face_id(dim, d, side) == face) return;
+        }
+    }
+}
+
+#endif //DG_BASIS_H
@@ -0,0 +1,62 @@
+//
+// Created by kihiro on 5/25/20.
+//
+
+#ifndef DG_BOUNDARY_H
+#define DG_BOUNDARY_H
+
+#include <string>
+#include "types.h"
+
+/*! \brief Boundary condition types, one specialized residual kernel each
+ *
+ */
+enum BCType {
+    BC_WALL,
+    BC_INFLOW,
+    BC_OUTFLOW,
+    N_BC_TYPE, //!< number of types, also returned for unknown names
+};
+
+/*! \brief Boundary condition type from its name in the input file
+ *
+ * @param name "wall", "inflow" or "outflow"
+ * @return type, N_BC_TYPE if the name is unknown
+ */
+inline BCType bc_type_from_name(const std::string &name) {
+    if (name == "wall") return BC_WALL;
+    if (name == "inflow") return BC_INFLOW;
+    if (name == "outflow") return BC_OUTFLOW;
+    return N_BC_TYPE;
+}
+
+/*! \brief Boundary flux of a boundary condition type
+ *
+ * Toy fluxes in the spirit of the interior face kernel: they only depend on the face ID and on the
+ * total number of iterations, each type scaling the contribution differently.
+ */
+template <BCType type>
+struct BoundaryFlux;
+
+template <>
+struct BoundaryFlux<BC_WALL> {
+    static inline rtype value(const int bface, const int k, const int nIter) {
+        return (rtype) (bface+k) / (rtype) (bface+1) / (rtype) nIter;
+    }
+};
+
+template <>
+struct BoundaryFlux<BC_INFLOW> {
+    static inline rtype value(const int bface, const int k, const int nIter) {
+        return (rtype) 2. * (rtype) (bface+k) / (rtype) (bface+1) / (rtype) nIter;
+    }
+};
+
+template <>
+struct BoundaryFlux<BC_OUTFLOW> {
+    static inline rtype value(const int bface, const int k, const int nIter) {
+        return (rtype) 0.5 * (rtype) (bface+k) / (rtype) (bface+1) / (rtype) nIter;
+    }
+};
+
+#endif //DG_BOUNDARY_H
@@ -0,0 +1,76 @@
+//
+// Created by kihiro on 4/14/20.
+//
+
+#include <cmath>
+#include <cstdio>
+#include "legion.h"
+#include "convergence_monitor.h"
+#include "ids.h"
+
+using namespace Legion;
+using namespace std;
+
+bool not_converged_task(const Task *task, const std::vector<PhysicalRegion> &regions,
+                        Context ctx, Runtime *runtime) {
+    rtype tolerance = *(const rtype *)task->args;
+    rtype norm2 = task->futures[0].get_result<rtype>();
+    return sqrt(norm2) > tolerance;
+}
+
+void ConvergenceMonitor::register_tasks() {
+    {
+        TaskVariantRegistrar registrar(NOT_CONVERGED_TASK_ID, "not_converged_task");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf();
+        Runtime::preregister_task_variant<bool, not_converged_task> (registrar,
+            "not_converged_task");
+    }
+}
+
+ConvergenceMonitor::ConvergenceMonitor(Context ctx, HighLevelRuntime *runtime,
+                                       Legion::Logger &logger, const rtype tolerance_,
+                                       const int lag_) :
+    LegionData(ctx, runtime, logger), converged(false), converged_iteration(-1),
+    last_iteration(-1), last_norm(0.),
+    tolerance(tolerance_), lag(lag_), pred(Predicate::TRUE_PRED) {}
+
+void ConvergenceMonitor::push(const int iteration, const Future &norm2) {
+    pending.push_back(make_pair(iteration, norm2));
+
+    // the comparison with the tolerance is deferred to a task so that building the predicate
+    // does not wait on the norm
+    TaskLauncher launcher(NOT_CONVERGED_TASK_ID, TaskArgument(&tolerance, sizeof(rtype)));
+    launcher.add_future(norm2);
+    Future f = runtime->execute_task(ctx, launcher);
+    pred = runtime->create_predicate(ctx, f);
+}
+
+void ConvergenceMonitor::consume_front() {
+    last_iteration = pending.front().first;
+    last_norm = sqrt(pending.front().second.get_result<rtype>());
+    pending.pop_front();
+    // the norms that follow (of iterations predicated off) stay below the tolerance, only the
+    // first one is recorded
+    if (last_norm <= tolerance && !converged) {
+        converged = true;
+        converged_iteration = last_iteration;
+    }
+
+    char msg[100];
+    sprintf(msg, "Iteration %d: residual norm = %.10e\n", last_iteration, last_norm);
+    runtime->print_once(ctx, stdout, msg);
+}
+
+bool ConvergenceMonitor::poll() {
+    while (!pending.empty() &&
+           ((int) pending.size() > lag || pending.front().second.is_ready())) {
+        consume_front();
+    }
+    return converged;
+}
+
+bool ConvergenceMonitor::drain() {
+    while (!pending.empty()) consume_front();
+    return converged;
+}
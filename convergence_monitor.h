@@ -0,0 +1,81 @@
+//
+// Created by kihiro on 4/14/20.
+//
+
+#ifndef DG_CONVERGENCE_MONITOR_H
+#define DG_CONVERGENCE_MONITOR_H
+
+#include <deque>
+#include <utility>
+#include "legion.h"
+#include "mesh_data.h"
+#include "types.h"
+
+/*! \brief Monitor consuming residual norm futures with a lag
+ *
+ * Norms are pushed as futures right after they are launched. They are only read back once they are
+ * ready or once more than `lag` of them are pending, so that the control task never waits on the
+ * iterations that are still in flight. Each pushed norm also yields a predicate that is true as
+ * long as the norm is above the tolerance, which can be used to predicate subsequent launches.
+ */
+class ConvergenceMonitor : public LegionData {
+  public:
+    /*! \brief Pre-register the monitor related tasks
+     *
+     */
+    static void register_tasks();
+
+    /*! \brief Constructor
+     *
+     * @param ctx Legion's context
+     * @param runtime Legion's runtime
+     * @param logger
+     * @param tolerance tolerance on the L2 norm of the residual
+     * @param lag number of norms allowed to be pending before the monitor waits
+     */
+    ConvergenceMonitor(Legion::Context ctx, Legion::HighLevelRuntime *runtime,
+        Legion::Logger &logger, const rtype tolerance, const int lag);
+
+    /*! \brief Register the squared residual norm computed after a given iteration
+     *
+     * @param iteration iteration at which the norm was launched
+     * @param norm2 future holding the squared L2 norm of the residual
+     */
+    void push(const int iteration, const Legion::Future &norm2);
+
+    /*! \brief Consume the norms that are ready or that lag too far behind
+     *
+     * @return true if convergence has been observed
+     */
+    bool poll();
+
+    /*! \brief Consume all pending norms
+     *
+     * @return true if convergence has been observed
+     */
+    bool drain();
+
+    /*! \brief Predicate that is false once the last pushed norm is below the tolerance
+     *
+     * @return predicate to pass to the launchers
+     */
+    const Legion::Predicate &predicate() const { return pred; }
+
+    bool converged; //!< whether a consumed norm was below the tolerance
+    int converged_iteration; //!< iteration of the first consumed norm below the tolerance
+    int last_iteration; //!< iteration of the last consumed norm
+    rtype last_norm; //!< last consumed L2 norm
+
+  private:
+    /*! \brief Read back the oldest pending norm
+     *
+     */
+    void consume_front();
+
+    rtype tolerance; //!< tolerance on the L2 norm of the residual
+    int lag; //!< number of norms allowed to be pending
+    std::deque<std::pair<int, Legion::Future>> pending; //!< norms not read back yet
+    Legion::Predicate pred; //!< predicate built from the last pushed norm
+};
+
+#endif //DG_CONVERGENCE_MONITOR_H
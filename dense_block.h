@@ -0,0 +1,58 @@
+//
+// Created by kihiro on 6/15/20.
+//
+
+#ifndef DG_DENSE_BLOCK_H
+#define DG_DENSE_BLOCK_H
+
+#include "types.h"
+
+/*! \brief y += A x for a dense n x n block stored row after row
+ *
+ * The size is a template parameter so that the inner products are fully unrolled and vectorized
+ * by the compiler.
+ *
+ * @tparam n block size
+ * @param A block
+ * @param x input vector (size n)
+ * @param y updated vector (size n)
+ */
+template <int n>
+inline void block_gemv_add(const rtype *__restrict__ A, const rtype *__restrict__ x,
+                           rtype *__restrict__ y) {
+    for (int i=0; i<n; i++) {
+        rtype sum = 0.;
+        for (int j=0; j<n; j++) sum += A[i*n + j]*x[j];
+        y[i] += sum;
+    }
+}
+
+/*! \brief y -= A x for a dense n x n block stored row after row
+ *
+ */
+template <int n>
+inline void block_gemv_sub(const rtype *__restrict__ A, const rtype *__restrict__ x,
+                           rtype *__restrict__ y) {
+    for (int i=0; i<n; i++) {
+        rtype sum = 0.;
+        for (int j=0; j<n; j++) sum += A[i*n + j]*x[j];
+        y[i] -= sum;
+    }
+}
+
+/*! \brief C -= A B for dense n x n blocks stored row after row
+ *
+ * The i-k-j loop order keeps the innermost loop contiguous in B and C.
+ */
+template <int n>
+inline void block_gemm_sub(const rtype *__restrict__ A, const rtype *__restrict__ B,
+                           rtype *__restrict__ C) {
+    for (int i=0; i<n; i++) {
+        for (int k=0; k<n; k++) {
+            rtype a = A[i*n + k];
+            for (int j=0; j<n; j++) C[i*n + j] -= a*B[k*n + j];
+        }
+    }
+}
+
+#endif //DG_DENSE_BLOCK_H
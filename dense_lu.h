@@ -0,0 +1,108 @@
+//
+// Created by kihiro on 6/22/20.
+//
+
+#ifndef DG_DENSE_LU_H
+#define DG_DENSE_LU_H
+
+#include <cmath>
+#include "types.h"
+
+/*! \brief In-place LU factorization with partial pivoting of a dense n x n block
+ *
+ * On return the block holds L (unit diagonal, not stored) below the diagonal and U on and above
+ * it, with P A = L U, P being the row swaps (k, piv[k]) applied for k = 0, ..., n-1. The size is a
+ * template parameter so that batched calls on many blocks get fully unrolled inner loops.
+ *
+ * @tparam n block size
+ * @param A block stored row after row, overwritten by its factors
+ * @param piv pivot rows (size n)
+ */
+template <int n>
+inline void block_lu_factor(rtype *__restrict__ A, int *__restrict__ piv) {
+    for (int k=0; k<n; k++) {
+        int p = k;
+        for (int i=k+1; i<n; i++) {
+            if (fabs(A[i*n + k]) > fabs(A[p*n + k])) p = i;
+        }
+        piv[k] = p;
+        if (p != k) {
+            for (int j=0; j<n; j++) {
+                rtype tmp = A[k*n + j];
+                A[k*n + j] = A[p*n + j];
+                A[p*n + j] = tmp;
+            }
+        }
+        rtype inv = (rtype) 1. / A[k*n + k];
+        for (int i=k+1; i<n; i++) {
+            rtype l = A[i*n + k] *= inv;
+            for (int j=k+1; j<n; j++) A[i*n + j] -= l*A[k*n + j];
+        }
+    }
+}
+
+/*! \brief Solve A x = b in place from the factors of block_lu_factor
+ *
+ * @tparam n block size
+ * @param LU factors
+ * @param piv pivot rows
+ * @param x right-hand side, overwritten by the solution (size n)
+ */
+template <int n>
+inline void block_lu_solve(const rtype *__restrict__ LU, const int *__restrict__ piv,
+                           rtype *__restrict__ x) {
+    for (int k=0; k<n; k++) {
+        if (piv[k] != k) {
+            rtype tmp = x[k];
+            x[k] = x[piv[k]];
+            x[piv[k]] = tmp;
+        }
+    }
+    for (int i=1; i<n; i++) {
+        rtype sum = 0.;
+        for (int j=0; j<i; j++) sum += LU[i*n + j]*x[j];
+        x[i] -= sum;
+    }
+    for (int i=n-1; i>=0; i--) {
+        rtype sum = 0.;
+        for (int j=i+1; j<n; j++) sum += LU[i*n + j]*x[j];
+        x[i] = (x[i] - sum) / LU[i*n + i];
+    }
+}
+
+/*! \brief Solve X A = B in place from the factors of block_lu_factor
+ *
+ * Every row x of X solves A^T x = b, i.e. U^T L^T P x = b, with a forward substitution on U^T, a
+ * backward one on L^T and the row swaps undone in reverse order.
+ *
+ * @tparam n block size
+ * @param LU factors
+ * @param piv pivot rows
+ * @param B right-hand side block stored row after row, overwritten by the solution
+ */
+template <int n>
+inline void block_lu_right_solve(const rtype *__restrict__ LU, const int *__restrict__ piv,
+                                 rtype *__restrict__ B) {
+    for (int r=0; r<n; r++) {
+        rtype *x = B + r*n;
+        for (int j=0; j<n; j++) {
+            rtype sum = 0.;
+            for (int i=0; i<j; i++) sum += LU[i*n + j]*x[i];
+            x[j] = (x[j] - sum) / LU[j*n + j];
+        }
+        for (int j=n-2; j>=0; j--) {
+            rtype sum = 0.;
+            for (int i=j+1; i<n; i++) sum += LU[i*n + j]*x[i];
+            x[j] -= sum;
+        }
+        for (int k=n-1; k>=0; k--) {
+            if (piv[k] != k) {
+                rtype tmp = x[k];
+                x[k] = x[piv[k]];
+                x[piv[k]] = tmp;
+            }
+        }
+    }
+}
+
+#endif //DG_DENSE_LU_H
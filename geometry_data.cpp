@@ -0,0 +1,269 @@
+//
+// Created by kihiro on 5/18/20.
+//
+
+#include <cmath>
+#include <vector>
+#include "legion.h"
+#include "basis.h"
+#include "geometry_data.h"
+#include "ids.h"
+#include "typedefs.h"
+
+using namespace Legion;
+using namespace LegionRuntime;
+using namespace std;
+
+/*! \brief Jacobian of the reference to physical mapping
+ *
+ * @param arg geometry arguments
+ * @param coord element node coordinates, node after node, nodes ordered lexicographically
+ * @param xi reference coordinates of the evaluation point
+ * @param jac Jacobian d x_a / d xi_b stored row after row (size dim*dim)
+ * @param phi work array for the 1D basis functions (size dim*(order+1))
+ * @param dphi work array for their derivatives (size dim*(order+1))
+ */
+static void jacobian(const GeometryArgs &arg, const rtype *coord, const rtype *xi, rtype *jac,
+                     rtype *phi, rtype *dphi) {
+    int n1 = arg.order + 1;
+    for (int d=0; d<arg.dim; d++) {
+        lagrange_1d(arg.order, xi[d], &phi[d*n1]);
+        lagrange_1d_deriv(arg.order, xi[d], &dphi[d*n1]);
+    }
+    for (int i=0; i<arg.dim*arg.dim; i++) jac[i] = 0.;
+
+    int nNode = arg.dim==3 ? n1*n1*n1 : n1*n1;
+    for (int inode=0; inode<nNode; inode++) {
+        int idx[3] = {inode%n1, (inode/n1)%n1, inode/(n1*n1)};
+        for (int b=0; b<arg.dim; b++) {
+            // derivative of the tensor product basis function along b
+            rtype grad = 1.;
+            for (int d=0; d<arg.dim; d++) grad *= d==b ? dphi[d*n1 + idx[d]] : phi[d*n1 + idx[d]];
+            for (int a=0; a<arg.dim; a++) jac[a*arg.dim + b] += coord[inode*arg.dim + a]*grad;
+        }
+    }
+}
+
+/*! \brief Determinant and inverse of a 2x2 or 3x3 matrix stored row after row
+ *
+ * @return determinant
+ */
+static rtype invert(const int dim, const rtype *m, rtype *inv) {
+    if (dim == 2) {
+        rtype det = m[0]*m[3] - m[1]*m[2];
+        inv[0] =  m[3]/det;
+        inv[1] = -m[1]/det;
+        inv[2] = -m[2]/det;
+        inv[3] =  m[0]/det;
+        return det;
+    }
+    rtype det = m[0]*(m[4]*m[8] - m[5]*m[7])
+              - m[1]*(m[3]*m[8] - m[5]*m[6])
+              + m[2]*(m[3]*m[7] - m[4]*m[6]);
+    inv[0] = (m[4]*m[8] - m[5]*m[7])/det;
+    inv[1] = (m[2]*m[7] - m[1]*m[8])/det;
+    inv[2] = (m[1]*m[5] - m[2]*m[4])/det;
+    inv[3] = (m[5]*m[6] - m[3]*m[8])/det;
+    inv[4] = (m[0]*m[8] - m[2]*m[6])/det;
+    inv[5] = (m[2]*m[3] - m[0]*m[5])/det;
+    inv[6] = (m[3]*m[7] - m[4]*m[6])/det;
+    inv[7] = (m[1]*m[6] - m[0]*m[7])/det;
+    inv[8] = (m[0]*m[4] - m[1]*m[3])/det;
+    return det;
+}
+
+void compute_elem_geometry_task(const Task *task, const std::vector<PhysicalRegion> &regions,
+                                Context ctx, Runtime *runtime) {
+    GeometryArgs arg = *(const GeometryArgs *)task->args;
+    int dim = arg.dim;
+    int nNode = dim==3 ? (arg.order+1)*(arg.order+1)*(arg.order+1) : (arg.order+1)*(arg.order+1);
+    int nq = dim==3 ? arg.nq1d*arg.nq1d*arg.nq1d : arg.nq1d*arg.nq1d;
+    const AffAccROrtype acc_coord(regions[0], MeshData::FID_MESH_ELEM_NODE_COORDS,
+        nNode*dim*sizeof(rtype));
+    const AffAccWDrtype acc_detJ(regions[1], GeometryData::FID_GEOM_ELEM_DETJ, nq*sizeof(rtype));
+    const AffAccWDrtype acc_iJac(regions[1], GeometryData::FID_GEOM_ELEM_IJAC,
+        nq*dim*dim*sizeof(rtype));
+
+    vector<rtype> xq(arg.nq1d), wq(arg.nq1d);
+    gauss_legendre(arg.nq1d, xq.data(), wq.data());
+
+    rtype jac[9];
+    vector<rtype> phi(dim*(arg.order+1)), dphi(dim*(arg.order+1));
+    Domain domain = runtime->get_index_space_domain(ctx, task->regions[0].region.get_index_space());
+    for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+        const rtype *coord = acc_coord.ptr(itr.p);
+        rtype *detJ = acc_detJ.ptr(itr.p);
+        rtype *iJac = acc_iJac.ptr(itr.p);
+        for (int iq=0; iq<nq; iq++) {
+            rtype xi[3] = {xq[iq%arg.nq1d], xq[(iq/arg.nq1d)%arg.nq1d], xq[iq/(arg.nq1d*arg.nq1d)]};
+            jacobian(arg, coord, xi, jac, phi.data(), dphi.data());
+            detJ[iq] = invert(dim, jac, iJac + iq*dim*dim);
+        }
+    }
+}
+
+void compute_iface_geometry_task(const Task *task, const std::vector<PhysicalRegion> &regions,
+                                 Context ctx, Runtime *runtime) {
+    GeometryArgs arg = *(const GeometryArgs *)task->args;
+    int dim = arg.dim;
+    int nNode = dim==3 ? (arg.order+1)*(arg.order+1)*(arg.order+1) : (arg.order+1)*(arg.order+1);
+    int nq = dim==3 ? arg.nq1d*arg.nq1d : arg.nq1d;
+    const AffAccROPoint1 acc_elemL(regions[0], MeshData::FID_MESH_IFACE_ELEMLID);
+    const AffAccROint acc_faceL(regions[0], MeshData::FID_MESH_IFACE_FACEL);
+    const AffAccROrtype acc_coord(regions[1], MeshData::FID_MESH_ELEM_NODE_COORDS,
+        nNode*dim*sizeof(rtype));
+    const AffAccWDrtype acc_normal(regions[2], GeometryData::FID_GEOM_IFACE_NORMAL,
+        nq*dim*sizeof(rtype));
+    const AffAccWDrtype acc_sJac(regions[2], GeometryData::FID_GEOM_IFACE_SJAC, nq*sizeof(rtype));
+
+    vector<rtype> xq(arg.nq1d), wq(arg.nq1d);
+    gauss_legendre(arg.nq1d, xq.data(), wq.data());
+
+    rtype jac[9], iJac[9];
+    vector<rtype> phi(dim*(arg.order+1)), dphi(dim*(arg.order+1));
+    Domain domain = runtime->get_index_space_domain(ctx, task->regions[0].region.get_index_space());
+    for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+        const rtype *coord = acc_coord.ptr(acc_elemL[*itr]);
+        int d, side;
+        face_direction(dim, acc_faceL[*itr], d, side);
+        rtype *normal = acc_normal.ptr(itr.p);
+        rtype *sJac = acc_sJac.ptr(itr.p);
+        for (int iq=0; iq<nq; iq++) {
+            // reference coordinates on the face of the left element
+            rtype xi[3];
+            xi[d] = (rtype) side;
+            int t = 0;
+            for (int dd=0; dd<dim; dd++) {
+                if (dd == d) continue;
+                xi[dd] = xq[t==0 ? iq%arg.nq1d : iq/arg.nq1d];
+                t++;
+            }
+            jacobian(arg, coord, xi, jac, phi.data(), dphi.data());
+            rtype detJ = invert(dim, jac, iJac);
+            // Nanson's formula: n dS = detJ J^{-T} e_d dS_ref, grad xi_d points towards side 1
+            rtype norm = 0.;
+            for (int a=0; a<dim; a++) norm += iJac[d*dim + a]*iJac[d*dim + a];
+            norm = sqrt(norm);
+            rtype sign = side ? 1. : -1.;
+            for (int a=0; a<dim; a++) normal[iq*dim + a] = sign*iJac[d*dim + a]/norm;
+            sJac[iq] = fabs(detJ)*norm;
+        }
+    }
+}
+
+void GeometryData::register_tasks() {
+    {
+        TaskVariantRegistrar registrar(COMPUTE_ELEM_GEOMETRY_TASK_ID,
+            "compute_elem_geometry_task");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf();
+        Runtime::preregister_task_variant<compute_elem_geometry_task> (registrar,
+            "compute_elem_geometry_task");
+    }
+    {
+        TaskVariantRegistrar registrar(COMPUTE_IFACE_GEOMETRY_TASK_ID,
+            "compute_iface_geometry_task");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf();
+        Runtime::preregister_task_variant<compute_iface_geometry_task> (registrar,
+            "compute_iface_geometry_task");
+    }
+}
+
+GeometryData::GeometryData(Context ctx, HighLevelRuntime *runtime, Legion::Logger &logger,
+                           const int nq1d_) :
+    LegionData(ctx, runtime, logger), nq1d(nq1d_), nq_elem(-1), nq_face(-1), dim(-1), order(-1) {}
+
+GeometryData::~GeometryData() {
+    clean_up();
+}
+
+void GeometryData::clean_up() {
+    elem_lr.reset();
+    iface_lr.reset();
+    elem_fs.reset();
+    iface_fs.reset();
+}
+
+void GeometryData::create_geometry_region(const MeshData &mesh_data) {
+    dim = mesh_data.dim;
+    order = mesh_data.order;
+    nq_elem = dim==3 ? nq1d*nq1d*nq1d : nq1d*nq1d;
+    nq_face = dim==3 ? nq1d*nq1d : nq1d;
+
+    // element geometry
+    elem_fs.reset(ctx, runtime, runtime->create_field_space(ctx));
+    {
+        FieldAllocator allocator = runtime->create_field_allocator(ctx, elem_fs);
+        allocator.allocate_field(nq_elem*sizeof(rtype), FID_GEOM_ELEM_DETJ);
+        allocator.allocate_field(nq_elem*dim*dim*sizeof(rtype), FID_GEOM_ELEM_IJAC);
+    }
+    runtime->attach_name(elem_fs, FID_GEOM_ELEM_DETJ, "geom_elem_jacobian_determinant");
+    runtime->attach_name(elem_fs, FID_GEOM_ELEM_IJAC, "geom_elem_inverse_jacobian");
+
+    elem_lr.reset(ctx, runtime,
+        runtime->create_logical_region(ctx, mesh_data.elem_lr->get_index_space(), elem_fs));
+    runtime->attach_name(elem_lr.get(), "geom_elem_logical_region");
+    elem_lp = runtime->get_logical_partition(ctx, elem_lr, mesh_data.elem_lp.get_index_partition());
+    runtime->attach_name(elem_lp, "geom_elem_logical_partition");
+
+    // interior face geometry
+    iface_fs.reset(ctx, runtime, runtime->create_field_space(ctx));
+    {
+        FieldAllocator allocator = runtime->create_field_allocator(ctx, iface_fs);
+        allocator.allocate_field(nq_face*dim*sizeof(rtype), FID_GEOM_IFACE_NORMAL);
+        allocator.allocate_field(nq_face*sizeof(rtype), FID_GEOM_IFACE_SJAC);
+    }
+    runtime->attach_name(iface_fs, FID_GEOM_IFACE_NORMAL, "geom_iface_normal");
+    runtime->attach_name(iface_fs, FID_GEOM_IFACE_SJAC, "geom_iface_surface_jacobian");
+
+    iface_lr.reset(ctx, runtime,
+        runtime->create_logical_region(ctx, mesh_data.iface_lr->get_index_space(), iface_fs));
+    runtime->attach_name(iface_lr.get(), "geom_iface_logical_region");
+    iface_lp = runtime->get_logical_partition(ctx, iface_lr,
+        mesh_data.iface_lp.get_index_partition());
+    runtime->attach_name(iface_lp, "geom_iface_logical_partition");
+
+    domain = Domain::from_rect<1>(Arrays::Rect<1>(Arrays::Point<1>(0),
+        Arrays::Point<1>(mesh_data.nPart-1)));
+}
+
+void GeometryData::compute_geometry(const MeshData &mesh_data) {
+    GeometryArgs arg;
+    arg.dim = dim;
+    arg.order = order;
+    arg.nq1d = nq1d;
+
+    // element metrics
+    {
+        IndexLauncher index_launcher(COMPUTE_ELEM_GEOMETRY_TASK_ID, domain,
+            TaskArgument(&arg, sizeof(GeometryArgs)), ArgumentMap());
+        RegionRequirement req(mesh_data.elem_lp, 0, READ_ONLY, EXCLUSIVE, mesh_data.elem_lr);
+        req.add_field(MeshData::FID_MESH_ELEM_NODE_COORDS);
+        index_launcher.add_region_requirement(req);
+        req = RegionRequirement(elem_lp, 0, WRITE_DISCARD, EXCLUSIVE, elem_lr);
+        req.add_field(FID_GEOM_ELEM_DETJ);
+        req.add_field(FID_GEOM_ELEM_IJAC);
+        index_launcher.add_region_requirement(req);
+        runtime->execute_index_space(ctx, index_launcher);
+    }
+
+    // face metrics, computed from the left element, which iface_lp (preimage of elem_lp by the
+    // left element) always places in the piece's own elements
+    {
+        IndexLauncher index_launcher(COMPUTE_IFACE_GEOMETRY_TASK_ID, domain,
+            TaskArgument(&arg, sizeof(GeometryArgs)), ArgumentMap());
+        RegionRequirement req(mesh_data.iface_lp, 0, READ_ONLY, EXCLUSIVE, mesh_data.iface_lr);
+        req.add_field(MeshData::FID_MESH_IFACE_ELEMLID);
+        req.add_field(MeshData::FID_MESH_IFACE_FACEL);
+        index_launcher.add_region_requirement(req);
+        req = RegionRequirement(mesh_data.elem_lp, 0, READ_ONLY, EXCLUSIVE, mesh_data.elem_lr);
+        req.add_field(MeshData::FID_MESH_ELEM_NODE_COORDS);
+        index_launcher.add_region_requirement(req);
+        req = RegionRequirement(iface_lp, 0, WRITE_DISCARD, EXCLUSIVE, iface_lr);
+        req.add_field(FID_GEOM_IFACE_NORMAL);
+        req.add_field(FID_GEOM_IFACE_SJAC);
+        index_launcher.add_region_requirement(req);
+        runtime->execute_index_space(ctx, index_launcher);
+    }
+}
@@ -0,0 +1,102 @@
+//
+// Created by kihiro on 5/18/20.
+//
+
+#ifndef DG_GEOMETRY_DATA_H
+#define DG_GEOMETRY_DATA_H
+
+#include "legion.h"
+#include "legion_handle.h"
+#include "mesh_data.h"
+
+/*! \brief Arguments of the geometry tasks
+ *
+ */
+struct GeometryArgs {
+    int dim; //!< number of spatial dimensions
+    int order; //!< geometric order
+    int nq1d; //!< number of quadrature points per direction
+};
+
+/*! \brief Class holding the geometric factors of the mesh
+ *
+ * The metrics are computed once from the element nodes and stored at the quadrature points in
+ * regions sharing the index spaces (and thus the partitions) of the mesh element and interior face
+ * regions. Quadrature points are the tensor product of nq1d Gauss-Legendre points, ordered
+ * lexicographically. For faces, the points are the ones of the left element's face, the tangential
+ * directions being ordered by increasing reference direction.
+ */
+class GeometryData : public LegionData {
+  public:
+    /*! \brief Geometry regions' fields
+     *
+     * Each field is stored separately (structure of arrays), one value per quadrature point.
+     */
+    enum FieldIDs {
+        FID_GEOM_ELEM_DETJ, //!< determinant of the Jacobian
+        FID_GEOM_ELEM_IJAC, //!< inverse of the Jacobian, d xi_a / d x_b stored row after row
+        FID_GEOM_IFACE_NORMAL, //!< unit normal pointing from the left to the right element
+        FID_GEOM_IFACE_SJAC, //!< surface Jacobian (face area element)
+    };
+
+    /*! \brief Pre-register all geometry related tasks
+     *
+     */
+    static void register_tasks();
+
+    /*! \brief Constructor
+     *
+     * @param ctx Legion's context
+     * @param runtime Legion's runtime
+     * @param logger
+     * @param nq1d number of quadrature points per direction
+     */
+    GeometryData(Legion::Context ctx, Legion::HighLevelRuntime *runtime, Legion::Logger &logger,
+                 const int nq1d);
+
+    /*! \brief Destructor
+     *
+     * Release the Legion ressources that are still owned.
+     */
+    ~GeometryData();
+
+    /*! \brief Clean up Legion's ressources used for geometry related regions
+     *
+     * Called by the destructor as well. The partitions belong to the mesh data.
+     */
+    void clean_up();
+
+    /*! \brief Create the geometry regions
+     *
+     * The fields are not initialized yet after this method is called.
+     *
+     * @param mesh_data mesh regions, already initialized and partitioned
+     */
+    void create_geometry_region(const MeshData &mesh_data);
+
+    /*! \brief Compute the geometric factors
+     *
+     * One index launch over the elements and one over the interior faces. Both only read the mesh
+     * regions and can run concurrently.
+     *
+     * @param mesh_data mesh regions
+     */
+    void compute_geometry(const MeshData &mesh_data);
+
+    int nq1d; //!< number of quadrature points per direction
+    int nq_elem; //!< number of quadrature points per element
+    int nq_face; //!< number of quadrature points per face
+    int dim; //!< number of spatial dimensions
+    LegionHandle<Legion::LogicalRegion> elem_lr; //!< element geometry logical region
+    Legion::LogicalPartition elem_lp; //!< element geometry logical partition
+    LegionHandle<Legion::LogicalRegion> iface_lr; //!< interior face geometry logical region
+    Legion::LogicalPartition iface_lp; //!< interior face geometry logical partition
+
+  private:
+    int order; //!< geometric order
+    Legion::Domain domain; //!< domain associated with the partitioninig index space
+    LegionHandle<Legion::FieldSpace> elem_fs; //!< element field space
+    LegionHandle<Legion::FieldSpace> iface_fs; //!< interior face field space
+};
+
+#endif //DG_GEOMETRY_DATA_H
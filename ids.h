@@ -5,13 +5,53 @@
 #ifndef DG_IDS_H
 #define DG_IDS_H
 
+#define MG_ORDER_IDS 4 // task IDs reserved per p-multigrid task, orders 0 to 3
+
 enum TaskIDs {
     TOP_LEVEL_TASK_ID = 100,
+    INIT_MESH_ELEM_TASK_ID,
+    INIT_MESH_IFACE_TASK_ID,
+    INIT_MESH_BFACE_TASK_ID,
+    INIT_MESH_NODE_RANGE_TASK_ID,
     ZERO_FIELD_TASK_ID,
     COMPUTE_IFACE_RESIDUAL_TASK_ID,
+    COMPUTE_VOLUME_RESIDUAL_TASK_ID,
+    ACCUMULATE_FACE_RESIDUAL_TASK_ID,
+    RK_UPDATE_TASK_ID,
+    LINEAR_COMBINATION_TASK_ID,
+    DOT_TASK_ID,
+    FD_STEP_TASK_ID,
+    COMPUTE_BFACE_RESIDUAL_WALL_TASK_ID,
+    COMPUTE_BFACE_RESIDUAL_INFLOW_TASK_ID,
+    COMPUTE_BFACE_RESIDUAL_OUTFLOW_TASK_ID,
     COMPUTE_ERROR_TASK_ID,
-    COPY_TO_REFERENCE_TASK_ID,
+    COMPUTE_RESIDUAL_NORM_TASK_ID,
     CHECK_TASK_ID,
+    NOT_CONVERGED_TASK_ID,
+    OUTPUT_TASK_ID,
+    SHM_EXPORT_TASK_ID,
+    SHM_UNLINK_TASK_ID,
+    COMPUTE_ELEM_GEOMETRY_TASK_ID,
+    COMPUTE_IFACE_GEOMETRY_TASK_ID,
+    INTERPOLATE_TRACE_TASK_ID,
+    COMPUTE_IFACE_TRACE_RESIDUAL_TASK_ID,
+    LIFT_TRACE_TASK_ID,
+    INIT_JACOBIAN_TASK_ID,
+    INIT_JACOBIAN_DIAG_TASK_ID,
+    ASSEMBLE_IFACE_JACOBIAN_TASK_ID,
+    BLOCK_SPMV_TASK_ID,
+    FACTOR_PRECONDITIONER_TASK_ID,
+    APPLY_PRECONDITIONER_TASK_ID,
+    CHECK_ELEM_PARTITION_TASK_ID,
+    CHECK_HALO_PARTITION_TASK_ID,
+    // p-multigrid tasks, one variant per order p with ID + p, MG_ORDER_IDS IDs reserved for each
+    MG_ELEM_RESIDUAL_TASK_ID,
+    MG_IFACE_RESIDUAL_TASK_ID = MG_ELEM_RESIDUAL_TASK_ID + MG_ORDER_IDS,
+    MG_SMOOTH_TASK_ID = MG_IFACE_RESIDUAL_TASK_ID + MG_ORDER_IDS,
+    MG_FORCING_TASK_ID = MG_SMOOTH_TASK_ID + MG_ORDER_IDS,
+    MG_NORM_TASK_ID = MG_FORCING_TASK_ID + MG_ORDER_IDS,
+    MG_RESTRICT_TASK_ID = MG_NORM_TASK_ID + MG_ORDER_IDS, //!< p is the fine order
+    MG_PROLONGATE_TASK_ID = MG_RESTRICT_TASK_ID + MG_ORDER_IDS, //!< p is the fine order
 };
 
 #endif //DG_IDS_H
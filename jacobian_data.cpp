@@ -0,0 +1,385 @@
+//
+// Created by kihiro on 6/15/20.
+//
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+#include "legion.h"
+#include "jacobian_data.h"
+#include "dense_block.h"
+#include "ids.h"
+#include "redop.h"
+#include "typedefs.h"
+
+using namespace Legion;
+using namespace LegionRuntime;
+using namespace std;
+
+void init_jacobian_task(const Task *task, const std::vector<PhysicalRegion> &regions,
+                        Context ctx, Runtime *runtime) {
+    // integers of each point of the piece, in order, their layout depends on the filled fields
+    const int *data = (const int *)task->local_args;
+    Rect<1> rect = runtime->get_index_space_domain(ctx,
+        task->regions[0].region.get_index_space());
+    FieldID fid = *task->regions[0].privilege_fields.begin();
+    if (fid == JacobianData::FID_JAC_ROW_RANGE) {
+        // first and last block of the row
+        const AffAccWDRect1 acc_range(regions[0], JacobianData::FID_JAC_ROW_RANGE);
+        for (PointInRectIterator<1> pir(rect); pir(); pir++) {
+            coord_t i = (*pir)[0] - rect.lo[0];
+            acc_range[*pir] = Rect<1>(data[2*i], data[2*i + 1]);
+        }
+    }
+    else if (fid == JacobianData::FID_JAC_BLOCK_COL) {
+        // column of the block
+        const AffAccWDPoint1 acc_col(regions[0], JacobianData::FID_JAC_BLOCK_COL);
+        for (PointInRectIterator<1> pir(rect); pir(); pir++) {
+            acc_col[*pir] = data[(*pir)[0] - rect.lo[0]];
+        }
+    }
+    else {
+        // blocks of the face in the left and right element's rows
+        const AffAccWDPoint1 acc_LR(regions[0], JacobianData::FID_JAC_IFACE_BLOCK_LR);
+        const AffAccWDPoint1 acc_RL(regions[0], JacobianData::FID_JAC_IFACE_BLOCK_RL);
+        for (PointInRectIterator<1> pir(rect); pir(); pir++) {
+            coord_t i = (*pir)[0] - rect.lo[0];
+            acc_LR[*pir] = data[2*i];
+            acc_RL[*pir] = data[2*i + 1];
+        }
+    }
+}
+
+void init_jacobian_diag_task(const Task *task, const std::vector<PhysicalRegion> &regions,
+                             Context ctx, Runtime *runtime) {
+    rtype shift = *(const rtype *)task->args;
+    const AffAccWDrtype acc_diag(regions[0], JacobianData::FID_JAC_DIAG, N_BLOCK*sizeof(rtype));
+    Domain domain = runtime->get_index_space_domain(ctx, task->regions[0].region.get_index_space());
+    for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+        rtype *diag = acc_diag.ptr(itr.p);
+        for (int k=0; k<N_BLOCK; k++) diag[k] = 0.;
+        for (int i=0; i<N_REDOP; i++) diag[i*N_REDOP + i] = shift;
+    }
+}
+
+void assemble_iface_jacobian_task(const Task *task, const std::vector<PhysicalRegion> &regions,
+                                  Context ctx, Runtime *runtime) {
+    const AffAccROPoint1 acc_elemL(regions[0], MeshData::FID_MESH_IFACE_ELEMLID);
+    const AffAccROPoint1 acc_elemR(regions[0], MeshData::FID_MESH_IFACE_ELEMRID);
+    const AffAccROPoint1 acc_LR(regions[1], JacobianData::FID_JAC_IFACE_BLOCK_LR);
+    const AffAccROPoint1 acc_RL(regions[1], JacobianData::FID_JAC_IFACE_BLOCK_RL);
+    ReductionAccessor<ReductionSum<N_BLOCK>, true, // exclusive
+            1, coord_t, Realm::AffineAccessor<ReductionSum<N_BLOCK>::LHS, 1, coord_t> >
+            acc_diag(regions[2], JacobianData::FID_JAC_DIAG, REDOP_BLOCK_SUM_ID);
+    ReductionAccessor<ReductionSum<N_BLOCK>, true, // exclusive
+            1, coord_t, Realm::AffineAccessor<ReductionSum<N_BLOCK>::LHS, 1, coord_t> >
+            acc_block(regions[3], JacobianData::FID_JAC_BLOCK_VALUE, REDOP_BLOCK_SUM_ID);
+
+    // toy face blocks in the spirit of the face residual: the diagonal contributions are a
+    // diagonally dominant pattern, the couplings a negative identity, both scaled per face
+    vector<rtype> pattern(N_BLOCK);
+    for (int i=0; i<N_REDOP; i++) {
+        for (int j=0; j<N_REDOP; j++) {
+            pattern[i*N_REDOP + j] = i==j ? 1. : (rtype) 0.1 / (rtype) (1 + abs(i-j));
+        }
+    }
+    ReductionSum<N_BLOCK>::RHS diag, coupling;
+    Domain domain = runtime->get_index_space_domain(ctx, task->regions[0].region.get_index_space());
+    for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+        rtype c = (rtype) 1. / (rtype) (itr.p[0]%8 + 1);
+        for (int k=0; k<N_BLOCK; k++) {
+            diag.value[k] = c*pattern[k];
+            coupling.value[k] = 0.;
+        }
+        for (int i=0; i<N_REDOP; i++) coupling.value[i*N_REDOP + i] = -c;
+
+        ReductionSum<N_BLOCK>::apply<true>(*acc_diag.ptr(acc_elemL[*itr]), diag);
+        ReductionSum<N_BLOCK>::apply<true>(*acc_diag.ptr(acc_elemR[*itr]), diag);
+        ReductionSum<N_BLOCK>::apply<true>(*acc_block.ptr(acc_LR[*itr]), coupling);
+        ReductionSum<N_BLOCK>::apply<true>(*acc_block.ptr(acc_RL[*itr]), coupling);
+    }
+}
+
+void block_spmv_task(const Task *task, const std::vector<PhysicalRegion> &regions,
+                     Context ctx, Runtime *runtime) {
+    SpMVArgs arg = *(const SpMVArgs *)task->args;
+    const AffAccROrtype acc_diag(regions[0], JacobianData::FID_JAC_DIAG, N_BLOCK*sizeof(rtype));
+    const AffAccRORect1 acc_range(regions[0], JacobianData::FID_JAC_ROW_RANGE);
+    const AffAccROPoint1 acc_col(regions[1], JacobianData::FID_JAC_BLOCK_COL);
+    const AffAccROrtype acc_block(regions[1], JacobianData::FID_JAC_BLOCK_VALUE,
+        N_BLOCK*sizeof(rtype));
+    const AffAccROrtype acc_x(regions[2], arg.x, N_REDOP*sizeof(rtype));
+    const AffAccWDrtype acc_y(regions[3], arg.y, N_REDOP*sizeof(rtype));
+
+    Domain domain = runtime->get_index_space_domain(ctx, task->regions[0].region.get_index_space());
+    for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+        rtype *y = acc_y.ptr(itr.p);
+        for (int k=0; k<N_REDOP; k++) y[k] = 0.;
+        block_gemv_add<N_REDOP>(acc_diag.ptr(itr.p), acc_x.ptr(itr.p), y);
+        // the blocks of the row are contiguous, their columns may be halo elements
+        Rect<1> range = acc_range[*itr];
+        for (PointInRectIterator<1> pir(range); pir(); pir++) {
+            block_gemv_add<N_REDOP>(acc_block.ptr(*pir), acc_x.ptr(acc_col[*pir]), y);
+        }
+    }
+}
+
+void JacobianData::register_tasks() {
+    {
+        TaskVariantRegistrar registrar(INIT_JACOBIAN_TASK_ID, "init_jacobian_task");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf();
+        Runtime::preregister_task_variant<init_jacobian_task> (registrar, "init_jacobian_task");
+    }
+    {
+        TaskVariantRegistrar registrar(INIT_JACOBIAN_DIAG_TASK_ID, "init_jacobian_diag_task");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf();
+        Runtime::preregister_task_variant<init_jacobian_diag_task> (registrar,
+            "init_jacobian_diag_task");
+    }
+    {
+        TaskVariantRegistrar registrar(ASSEMBLE_IFACE_JACOBIAN_TASK_ID,
+            "assemble_iface_jacobian_task");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf();
+        Runtime::preregister_task_variant<assemble_iface_jacobian_task> (registrar,
+            "assemble_iface_jacobian_task");
+    }
+    {
+        TaskVariantRegistrar registrar(BLOCK_SPMV_TASK_ID, "block_spmv_task");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf();
+        Runtime::preregister_task_variant<block_spmv_task> (registrar, "block_spmv_task");
+    }
+}
+
+JacobianData::JacobianData(Context ctx, HighLevelRuntime *runtime, Legion::Logger &logger) :
+    LegionData(ctx, runtime, logger), nElem(0), nBlock(0) {}
+
+JacobianData::~JacobianData() {
+    clean_up();
+}
+
+void JacobianData::clean_up() {
+    block_ip.reset();
+    block_face_ip.reset();
+
+    elem_lr.reset();
+    block_lr.reset();
+    iface_lr.reset();
+
+    elem_fs.reset();
+    block_fs.reset();
+    iface_fs.reset();
+
+    block_is.reset();
+    part_is.reset();
+}
+
+void JacobianData::allocate_field(const FieldSpace &fs, const FieldID fid, const size_t size,
+                                  const string &name) {
+    vector<FieldID> fields;
+    runtime->get_field_space_fields(ctx, fs, fields);
+    if (find(fields.begin(), fields.end(), fid) != fields.end()) return;
+    FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
+    allocator.allocate_field(size, fid);
+    runtime->attach_name(fs, fid, name.c_str());
+}
+
+void JacobianData::allocate_elem_field(const FieldID fid, const size_t size, const string &name) {
+    allocate_field(elem_fs, fid, size, name);
+}
+
+void JacobianData::allocate_block_field(const FieldID fid, const size_t size, const string &name) {
+    allocate_field(block_fs, fid, size, name);
+}
+
+void JacobianData::init_region(const LogicalRegion &lr, const vector<FieldID> &fields,
+                               const vector<int> &data, const int nInt) {
+    LegionHandle<IndexPartition> init_ip(ctx, runtime,
+        runtime->create_equal_partition(ctx, lr.get_index_space(), part_is));
+    LogicalPartition init_lp = runtime->get_logical_partition(ctx, lr, init_ip);
+
+    ArgumentMap arg_map;
+    for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+        Rect<1> piece = runtime->get_index_space_domain(ctx,
+            runtime->get_index_subspace(ctx, init_ip, itr.p));
+        if (piece.empty()) continue;
+        arg_map.set_point(itr.p, TaskArgument(&data[nInt*piece.lo[0]],
+            nInt*piece.volume()*sizeof(int)));
+    }
+
+    IndexLauncher index_launcher(INIT_JACOBIAN_TASK_ID, domain, TaskArgument(), arg_map);
+    RegionRequirement req(init_lp, 0, WRITE_DISCARD, EXCLUSIVE, lr);
+    for (auto fid: fields) req.add_field(fid);
+    index_launcher.add_region_requirement(req);
+    runtime->execute_index_space(ctx, index_launcher);
+
+    // init_ip goes out of scope here, its deletion is deferred until the initialization is done
+}
+
+void JacobianData::create_jacobian_region(const Mesh &mesh, const MeshData &mesh_data) {
+    nElem = mesh.nElem;
+    int nIFace = mesh.nIface;
+    part_is.reset(ctx, runtime, runtime->create_index_space(ctx, Rect<1>(0, mesh_data.nPart-1)));
+    runtime->attach_name(part_is.get(), "jacobian_partition_index_space");
+    domain = Domain::from_rect<1>(Arrays::Rect<1>(Arrays::Point<1>(0),
+        Arrays::Point<1>(mesh_data.nPart-1)));
+
+    // block-CSR sparsity: every face adds a block to the rows of both of its elements, the blocks
+    // of a row are sorted by column (ties, between elements sharing several faces, by face)
+    vector<vector<pair<int, int>>> rows(nElem);
+    for (int iface=0; iface<nIFace; iface++) {
+        int elemL = mesh.IFace_to_elem[iface][0];
+        int elemR = mesh.IFace_to_elem[iface][3];
+        rows[elemL].push_back(make_pair(elemR, 2*iface));
+        rows[elemR].push_back(make_pair(elemL, 2*iface + 1));
+    }
+    nBlock = 2*nIFace;
+    vector<int> row_range(2*nElem), block_col(nBlock), face_block(2*nIFace);
+    int iblock = 0;
+    for (int ielem=0; ielem<nElem; ielem++) {
+        sort(rows[ielem].begin(), rows[ielem].end());
+        row_range[2*ielem] = iblock;
+        for (auto &entry: rows[ielem]) {
+            block_col[iblock] = entry.first;
+            face_block[entry.second] = iblock;
+            iblock++;
+        }
+        row_range[2*ielem + 1] = iblock - 1;
+    }
+
+    // diagonal blocks and rows, on the mesh element index space
+    elem_fs.reset(ctx, runtime, runtime->create_field_space(ctx));
+    {
+        FieldAllocator allocator = runtime->create_field_allocator(ctx, elem_fs);
+        allocator.allocate_field(N_BLOCK*sizeof(rtype), FID_JAC_DIAG);
+        allocator.allocate_field(sizeof(Rect<1>), FID_JAC_ROW_RANGE);
+    }
+    runtime->attach_name(elem_fs, FID_JAC_DIAG, "jac_elem_diagonal_block");
+    runtime->attach_name(elem_fs, FID_JAC_ROW_RANGE, "jac_elem_row_range");
+    elem_lr.reset(ctx, runtime,
+        runtime->create_logical_region(ctx, mesh_data.elem_lr->get_index_space(), elem_fs));
+    runtime->attach_name(elem_lr.get(), "jac_elem_logical_region");
+    elem_lp = runtime->get_logical_partition(ctx, elem_lr, mesh_data.elem_lp.get_index_partition());
+    runtime->attach_name(elem_lp, "jac_elem_logical_partition");
+    elem_with_halo_lp = runtime->get_logical_partition(ctx, elem_lr,
+        mesh_data.elem_with_halo_lp.get_index_partition());
+    runtime->attach_name(elem_with_halo_lp, "jac_elem_with_halo_logical_partition");
+
+    // off-diagonal blocks
+    block_is.reset(ctx, runtime, runtime->create_index_space(ctx, Rect<1>(0, nBlock-1)));
+    runtime->attach_name(block_is.get(), "jac_block_index_space");
+    block_fs.reset(ctx, runtime, runtime->create_field_space(ctx));
+    {
+        FieldAllocator allocator = runtime->create_field_allocator(ctx, block_fs);
+        allocator.allocate_field(sizeof(Point<1>), FID_JAC_BLOCK_COL);
+        allocator.allocate_field(N_BLOCK*sizeof(rtype), FID_JAC_BLOCK_VALUE);
+    }
+    runtime->attach_name(block_fs, FID_JAC_BLOCK_COL, "jac_block_column");
+    runtime->attach_name(block_fs, FID_JAC_BLOCK_VALUE, "jac_block_value");
+    block_lr.reset(ctx, runtime, runtime->create_logical_region(ctx, block_is, block_fs));
+    runtime->attach_name(block_lr.get(), "jac_block_logical_region");
+
+    // interior face to block maps, on the mesh interior face index space
+    iface_fs.reset(ctx, runtime, runtime->create_field_space(ctx));
+    {
+        FieldAllocator allocator = runtime->create_field_allocator(ctx, iface_fs);
+        allocator.allocate_field(sizeof(Point<1>), FID_JAC_IFACE_BLOCK_LR);
+        allocator.allocate_field(sizeof(Point<1>), FID_JAC_IFACE_BLOCK_RL);
+    }
+    runtime->attach_name(iface_fs, FID_JAC_IFACE_BLOCK_LR, "jac_iface_left_row_block");
+    runtime->attach_name(iface_fs, FID_JAC_IFACE_BLOCK_RL, "jac_iface_right_row_block");
+    iface_lr.reset(ctx, runtime,
+        runtime->create_logical_region(ctx, mesh_data.iface_lr->get_index_space(), iface_fs));
+    runtime->attach_name(iface_lr.get(), "jac_iface_logical_region");
+    iface_lp = runtime->get_logical_partition(ctx, iface_lr,
+        mesh_data.iface_lp.get_index_partition());
+    runtime->attach_name(iface_lp, "jac_iface_logical_partition");
+
+    init_region(elem_lr, {FID_JAC_ROW_RANGE}, row_range, 2);
+    init_region(block_lr, {FID_JAC_BLOCK_COL}, block_col, 1);
+    init_region(iface_lr, {FID_JAC_IFACE_BLOCK_LR, FID_JAC_IFACE_BLOCK_RL}, face_block, 2);
+
+    // blocks of the rows of each partition, and blocks updated by its faces (the left row ones are
+    // among the former, the right row ones may belong to other partitions)
+    block_ip.reset(ctx, runtime, runtime->create_partition_by_image_range(ctx, block_is,
+        elem_lp, elem_lr, FID_JAC_ROW_RANGE, part_is));
+    runtime->attach_name(block_ip.get(), "jac_block_index_partition");
+    block_lp = runtime->get_logical_partition(ctx, block_lr, block_ip);
+    runtime->attach_name(block_lp, "jac_block_logical_partition");
+    LegionHandle<IndexPartition> ip1(ctx, runtime, runtime->create_partition_by_image(ctx,
+        block_is, iface_lp, iface_lr, FID_JAC_IFACE_BLOCK_LR, part_is));
+    LegionHandle<IndexPartition> ip2(ctx, runtime, runtime->create_partition_by_image(ctx,
+        block_is, iface_lp, iface_lr, FID_JAC_IFACE_BLOCK_RL, part_is));
+    block_face_ip.reset(ctx, runtime, runtime->create_partition_by_union(ctx, block_is, ip1, ip2,
+        part_is));
+    runtime->attach_name(block_face_ip.get(), "jac_block_face_index_partition");
+    block_face_lp = runtime->get_logical_partition(ctx, block_lr, block_face_ip);
+    runtime->attach_name(block_face_lp, "jac_block_face_logical_partition");
+}
+
+void JacobianData::assemble(const rtype shift, const MeshData &mesh_data) {
+    {
+        IndexLauncher index_launcher(INIT_JACOBIAN_DIAG_TASK_ID, domain,
+            TaskArgument(&shift, sizeof(rtype)), ArgumentMap());
+        RegionRequirement req(elem_lp, 0, WRITE_DISCARD, EXCLUSIVE, elem_lr);
+        req.add_field(FID_JAC_DIAG);
+        index_launcher.add_region_requirement(req);
+        runtime->execute_index_space(ctx, index_launcher);
+    }
+    {
+        vector<rtype> zero(N_BLOCK, 0.);
+        IndexFillLauncher fill_launcher(domain, block_lp, block_lr,
+            TaskArgument(zero.data(), N_BLOCK*sizeof(rtype)));
+        fill_launcher.add_field(FID_JAC_BLOCK_VALUE);
+        runtime->fill_fields(ctx, fill_launcher);
+    }
+    {
+        IndexLauncher index_launcher(ASSEMBLE_IFACE_JACOBIAN_TASK_ID, domain, TaskArgument(),
+            ArgumentMap());
+        RegionRequirement req(mesh_data.iface_lp, 0, READ_ONLY, EXCLUSIVE, mesh_data.iface_lr);
+        req.add_field(MeshData::FID_MESH_IFACE_ELEMLID);
+        req.add_field(MeshData::FID_MESH_IFACE_ELEMRID);
+        index_launcher.add_region_requirement(req);
+        req = RegionRequirement(iface_lp, 0, READ_ONLY, EXCLUSIVE, iface_lr);
+        req.add_field(FID_JAC_IFACE_BLOCK_LR);
+        req.add_field(FID_JAC_IFACE_BLOCK_RL);
+        index_launcher.add_region_requirement(req);
+        req = RegionRequirement(elem_with_halo_lp, 0, REDOP_BLOCK_SUM_ID, EXCLUSIVE, elem_lr);
+        req.add_field(FID_JAC_DIAG);
+        index_launcher.add_region_requirement(req);
+        req = RegionRequirement(block_face_lp, 0, REDOP_BLOCK_SUM_ID, EXCLUSIVE, block_lr);
+        req.add_field(FID_JAC_BLOCK_VALUE);
+        index_launcher.add_region_requirement(req);
+        runtime->execute_index_space(ctx, index_launcher);
+    }
+}
+
+void JacobianData::spmv(const SolutionData &solution_data, const FieldID x, const FieldID y) {
+    SpMVArgs arg;
+    arg.x = x;
+    arg.y = y;
+    IndexLauncher index_launcher(BLOCK_SPMV_TASK_ID, domain, TaskArgument(&arg, sizeof(SpMVArgs)),
+        ArgumentMap());
+    RegionRequirement req(elem_lp, 0, READ_ONLY, EXCLUSIVE, elem_lr);
+    req.add_field(FID_JAC_DIAG);
+    req.add_field(FID_JAC_ROW_RANGE);
+    index_launcher.add_region_requirement(req);
+    req = RegionRequirement(block_lp, 0, READ_ONLY, EXCLUSIVE, block_lr);
+    req.add_field(FID_JAC_BLOCK_COL);
+    req.add_field(FID_JAC_BLOCK_VALUE);
+    index_launcher.add_region_requirement(req);
+    req = RegionRequirement(solution_data.elem_with_halo_lp, 0, READ_ONLY, EXCLUSIVE,
+        solution_data.elem_lr);
+    req.add_field(x);
+    index_launcher.add_region_requirement(req);
+    req = RegionRequirement(solution_data.elem_lp, 0, WRITE_DISCARD, EXCLUSIVE,
+        solution_data.elem_lr);
+    req.add_field(y);
+    index_launcher.add_region_requirement(req);
+    runtime->execute_index_space(ctx, index_launcher);
+}
@@ -0,0 +1,169 @@
+//
+// Created by kihiro on 6/15/20.
+//
+
+#ifndef DG_JACOBIAN_DATA_H
+#define DG_JACOBIAN_DATA_H
+
+#include <string>
+#include <vector>
+#include "legion.h"
+#include "legion_handle.h"
+#include "mesh.h"
+#include "mesh_data.h"
+#include "solution_data.h"
+
+/*! \brief Arguments of the block sparse matrix-vector product task
+ *
+ */
+struct SpMVArgs {
+    Legion::FieldID x; //!< input solution field
+    Legion::FieldID y; //!< output solution field
+};
+
+/*! \brief Class holding the element-block Jacobian in block-CSR format
+ *
+ * Block row e holds the N_REDOP x N_REDOP diagonal block of element e, stored in a region sharing
+ * the mesh element index space, and one off-diagonal block per interior face of e, coupling e to
+ * the element on the other side. The off-diagonal blocks live in their own index space, sorted by
+ * block row then by column; every row stores the range of its blocks, every block its column and
+ * every interior face the two blocks it contributes to (left row/right column and the reverse).
+ * The sparsity is built once from Mesh::IFace_to_elem.
+ *
+ * The element and face regions use the mesh partitions. The blocks are partitioned by the image of
+ * the row ranges of elem_lp, which gives each partition its block rows, and by the image of the
+ * face to block maps of iface_lp, which gives the blocks updated by the faces of each partition.
+ */
+class JacobianData : public LegionData {
+  public:
+    /*! \brief Jacobian regions' fields
+     *
+     */
+    enum FieldIDs {
+        FID_JAC_DIAG, //!< diagonal block of the element
+        FID_JAC_ROW_RANGE, //!< range of the off-diagonal blocks of the element's block row
+        FID_JAC_BLOCK_COL, //!< column (element) of the off-diagonal block
+        FID_JAC_BLOCK_VALUE, //!< off-diagonal block
+        FID_JAC_IFACE_BLOCK_LR, //!< block of the face in the left element's row
+        FID_JAC_IFACE_BLOCK_RL, //!< block of the face in the right element's row
+        FID_JAC_PC_LU, //!< preconditioner: LU factors of the (modified) diagonal block
+        FID_JAC_PC_PIVOT, //!< preconditioner: pivot rows of the diagonal block factors
+        FID_JAC_PC_BLOCK, //!< preconditioner: incomplete factors of the off-diagonal block
+    };
+
+    /*! \brief Pre-register all Jacobian related tasks
+     *
+     */
+    static void register_tasks();
+
+    /*! \brief Constructor
+     *
+     * @param ctx Legion's context
+     * @param runtime Legion's runtime
+     * @param logger
+     */
+    JacobianData(Legion::Context ctx, Legion::HighLevelRuntime *runtime, Legion::Logger &logger);
+
+    /*! \brief Destructor
+     *
+     * Release the Legion ressources that are still owned.
+     */
+    ~JacobianData();
+
+    /*! \brief Clean up Legion's ressources used for Jacobian related regions
+     *
+     * Called by the destructor as well. The element and face partitions belong to the mesh data.
+     */
+    void clean_up();
+
+    /*! \brief Create the Jacobian regions and their block-CSR sparsity
+     *
+     * The structure fields are filled in parallel like the mesh regions, the block values are not
+     * initialized yet.
+     *
+     * @param mesh mesh object providing the face to element connectivity
+     * @param mesh_data mesh regions, already initialized and partitioned
+     */
+    void create_jacobian_region(const Mesh &mesh, const MeshData &mesh_data);
+
+    /*! \brief Assemble the Jacobian
+     *
+     * The diagonal blocks are set to the shift times the identity, the off-diagonal blocks to
+     * zero, then every interior face scatters its four blocks with reductions: two into the
+     * diagonal blocks of its elements (halo elements included) and two into its off-diagonal
+     * blocks, one of which may belong to another partition. Does not block.
+     *
+     * @param shift diagonal shift (1/dt for backward Euler steps)
+     * @param mesh_data mesh regions
+     */
+    void assemble(const rtype shift, const MeshData &mesh_data);
+
+    /*! \brief Block sparse matrix-vector product y = J x on solution fields
+     *
+     * One task per partition computes its block rows, reading x on the elements with halo. Does
+     * not block.
+     *
+     * @param solution_data solution regions holding both fields
+     * @param x input field
+     * @param y output field, different from x
+     */
+    void spmv(const SolutionData &solution_data, const Legion::FieldID x, const Legion::FieldID y);
+
+    /*! \brief Allocate a field on the diagonal block and row field space if not allocated yet
+     *
+     * @param fid field ID
+     * @param size size of one entry in bytes
+     * @param name field name
+     */
+    void allocate_elem_field(const Legion::FieldID fid, const size_t size, const std::string &name);
+
+    /*! \brief Allocate a field on the off-diagonal block field space if not allocated yet
+     *
+     * @param fid field ID
+     * @param size size of one entry in bytes
+     * @param name field name
+     */
+    void allocate_block_field(const Legion::FieldID fid, const size_t size,
+                              const std::string &name);
+
+    int nElem; //!< number of block rows
+    int nBlock; //!< number of off-diagonal blocks
+    LegionHandle<Legion::LogicalRegion> elem_lr; //!< diagonal block and row logical region
+    Legion::LogicalPartition elem_lp; //!< block row logical partition
+    Legion::LogicalPartition elem_with_halo_lp; //!< block rows of the elements with halo
+    LegionHandle<Legion::LogicalRegion> block_lr; //!< off-diagonal block logical region
+    Legion::LogicalPartition block_lp; //!< off-diagonal blocks of the block rows of a partition
+    Legion::LogicalPartition block_face_lp; //!< off-diagonal blocks updated by a partition's faces
+    LegionHandle<Legion::LogicalRegion> iface_lr; //!< interior face to block logical region
+    Legion::LogicalPartition iface_lp; //!< interior face to block logical partition
+    Legion::Domain domain; //!< domain associated with the partitioninig index space
+
+  private:
+    /*! \brief Fill structure fields from a flat list of integers
+     *
+     * Every point of an equal partition of the region receives its slice of the list.
+     *
+     * @param lr region to fill
+     * @param fields fields to fill, the first one selects the layout (see init_jacobian_task)
+     * @param data nInt integers per point of the region
+     * @param nInt number of integers per point
+     */
+    void init_region(const Legion::LogicalRegion &lr, const std::vector<Legion::FieldID> &fields,
+                     const std::vector<int> &data, const int nInt);
+
+    /*! \brief Allocate a field on a field space if not allocated yet
+     *
+     */
+    void allocate_field(const Legion::FieldSpace &fs, const Legion::FieldID fid, const size_t size,
+                        const std::string &name);
+
+    LegionHandle<Legion::IndexSpace> part_is; //!< color space of the partitions
+    LegionHandle<Legion::IndexSpace> block_is; //!< off-diagonal block index space
+    LegionHandle<Legion::FieldSpace> elem_fs; //!< diagonal block and row field space
+    LegionHandle<Legion::FieldSpace> block_fs; //!< off-diagonal block field space
+    LegionHandle<Legion::FieldSpace> iface_fs; //!< interior face to block field space
+    LegionHandle<Legion::IndexPartition> block_ip; //!< backs block_lp
+    LegionHandle<Legion::IndexPartition> block_face_ip; //!< backs block_face_lp
+};
+
+#endif //DG_JACOBIAN_DATA_H
@@ -0,0 +1,118 @@
+//
+// Created by kihiro on 4/20/20.
+//
+
+#ifndef DG_LEGION_HANDLE_H
+#define DG_LEGION_HANDLE_H
+
+#include "legion.h"
+
+/*! \brief Destroy overloads used by LegionHandle
+ *
+ */
+namespace LegionHandleDestroy {
+    inline void destroy(Legion::Context ctx, Legion::Runtime *runtime,
+                        const Legion::IndexSpace &handle) {
+        runtime->destroy_index_space(ctx, handle);
+    }
+    inline void destroy(Legion::Context ctx, Legion::Runtime *runtime,
+                        const Legion::IndexPartition &handle) {
+        runtime->destroy_index_partition(ctx, handle);
+    }
+    inline void destroy(Legion::Context ctx, Legion::Runtime *runtime,
+                        const Legion::FieldSpace &handle) {
+        runtime->destroy_field_space(ctx, handle);
+    }
+    inline void destroy(Legion::Context ctx, Legion::Runtime *runtime,
+                        const Legion::LogicalRegion &handle) {
+        runtime->destroy_logical_region(ctx, handle);
+    }
+}
+
+/*! \brief Owner of a Legion handle
+ *
+ * The handle is destroyed when the owner is reset or goes out of scope. Deletions are deferred by
+ * Legion until the operations using the handle are done, so temporaries can be released as soon as
+ * the handles derived from them have been created. Owners can be moved but not copied.
+ *
+ * @tparam Handle IndexSpace, IndexPartition, FieldSpace or LogicalRegion
+ */
+template <typename Handle>
+class LegionHandle {
+  public:
+    /*! \brief Default constructor, owns nothing
+     *
+     */
+    LegionHandle() : ctx(), runtime(NULL), handle() {}
+
+    /*! \brief Take ownership of a handle
+     *
+     * @param ctx_ Legion's context in which the handle was created
+     * @param runtime_ Legion's runtime
+     * @param handle_ handle to own
+     */
+    LegionHandle(Legion::Context ctx_, Legion::Runtime *runtime_, const Handle &handle_)
+        : ctx(ctx_), runtime(runtime_), handle(handle_) {}
+
+    LegionHandle(const LegionHandle &) = delete;
+    LegionHandle &operator=(const LegionHandle &) = delete;
+
+    LegionHandle(LegionHandle &&other) : ctx(other.ctx), runtime(other.runtime),
+        handle(other.handle) {
+        other.runtime = NULL;
+    }
+
+    LegionHandle &operator=(LegionHandle &&other) {
+        if (this != &other) {
+            reset();
+            ctx = other.ctx;
+            runtime = other.runtime;
+            handle = other.handle;
+            other.runtime = NULL;
+        }
+        return *this;
+    }
+
+    ~LegionHandle() { reset(); }
+
+    /*! \brief Destroy the owned handle, if any
+     *
+     */
+    void reset() {
+        if (runtime != NULL) LegionHandleDestroy::destroy(ctx, runtime, handle);
+        runtime = NULL;
+    }
+
+    /*! \brief Destroy the owned handle, if any, and take ownership of another one
+     *
+     * @param ctx_ Legion's context in which the handle was created
+     * @param runtime_ Legion's runtime
+     * @param handle_ handle to own
+     */
+    void reset(Legion::Context ctx_, Legion::Runtime *runtime_, const Handle &handle_) {
+        reset();
+        ctx = ctx_;
+        runtime = runtime_;
+        handle = handle_;
+    }
+
+    /*! \brief Give up ownership without destroying the handle
+     *
+     * @return the handle
+     */
+    Handle release() {
+        runtime = NULL;
+        return handle;
+    }
+
+    const Handle &get() const { return handle; }
+    operator const Handle &() const { return handle; }
+    const Handle *operator->() const { return &handle; }
+
+  private:
+    Legion::Context ctx; //!< Legion's context
+    Legion::Runtime *runtime; //!< Legion's runtime, NULL when nothing is owned
+    Handle handle; //!< owned handle
+};
+
+#endif //DG_LEGION_HANDLE_H
@@ -2,12 +2,26 @@
 // Created by kihiro on 3/27/20.
 //
 
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
 #include <string>
+#include <vector>
 #include "toml11/toml.hpp"
 #include "legion.h"
 #include "mesh.h"
 #include "mesh_data.h"
+#include "geometry_data.h"
 #include "solution_data.h"
+#include "convergence_monitor.h"
+#include "solution_output.h"
+#include "time_integrator.h"
+#include "newton_krylov.h"
+#include "jacobian_data.h"
+#include "preconditioner.h"
+#include "p_multigrid.h"
 #include "redop.h"
 #include "ids.h"
 
@@ -21,7 +35,6 @@ void top_level_task(const Task *task, const std::vector<PhysicalRegion> &regions
     auto input_info = toml::parse("input.toml");
     auto nParts = toml::find<int>(input_info, "Mesh", "npartitions");
     auto nIter = toml::find<int>(input_info, "Mesh", "iter");
-    auto mesh_file = toml::find<string>(input_info, "Mesh", "file");
     Mesh mesh(input_info);
     mesh.partition(nParts);
     msg.str(std::string());
@@ -31,23 +44,309 @@ void top_level_task(const Task *task, const std::vector<PhysicalRegion> &regions
     MeshData mesh_data(ctx, runtime, logger);
     mesh_data.init_mesh_region(mesh);
     mesh_data.partition_mesh_region(mesh.nPart);
+    mesh_data.check_partitioning();
     runtime->print_once(ctx, stdout, "Mesh region initialized and partitioned\n");
 
+    // geometric factors at the quadrature points
+    int nq1d = mesh.order + 1;
+    if (input_info.contains("Geometry")) nq1d = toml::find<int>(input_info, "Geometry", "nq1d");
+    GeometryData geometry_data(ctx, runtime, logger, nq1d);
+    geometry_data.create_geometry_region(mesh_data);
+    geometry_data.compute_geometry(mesh_data);
+    runtime->print_once(ctx, stdout, "Geometry region computed\n");
 
     SolutionData solution_data(ctx, runtime, logger);
     solution_data.create_solution_region(mesh_data);
     runtime->print_once(ctx, stdout, "Solution region created\n");
     solution_data.zero_field();
+    if (mesh_data.nBFG > 0 && toml::find(input_info, "Boundaries").contains("types")) {
+        vector<string> types = toml::find<vector<string>>(input_info, "Boundaries", "types");
+        if ((int) types.size() > mesh_data.nBFG) {
+            runtime->print_once(ctx, stderr,
+                "More boundary condition types than boundary face groups\n");
+            exit(EXIT_FAILURE);
+        }
+        solution_data.set_boundary_types(types);
+    }
+
+    // exchange face traces instead of full halo elements
+    bool trace_only = false;
+    if (input_info.contains("Halo")) {
+        trace_only = toml::find<bool>(input_info, "Halo", "trace_only");
+    }
+    if (trace_only && !mesh.aligned_faces()) {
+        runtime->print_once(ctx, stderr, "Halo.trace_only requires aligned faces (face IDs of a "
+            "generated or refined mesh and orientation 0 on every interior face)\n");
+        exit(EXIT_FAILURE);
+    }
+    if (trace_only) solution_data.create_trace_region(mesh_data);
+
+    // element-local volume term, overlapped with the face reductions
+    bool volume = false;
+    if (input_info.contains("Residual")) {
+        volume = toml::find<bool>(input_info, "Residual", "volume");
+    }
+    if (volume) solution_data.use_face_accumulation_field();
+
+    // independent cases sharing the mesh, carried together by the face launches
+    if (input_info.contains("Ensemble")) {
+        if (trace_only) {
+            runtime->print_once(ctx, stderr, "Ensembles are not supported with Halo.trace_only\n");
+            exit(EXIT_FAILURE);
+        }
+        // the members only go through the face launches: the volume term, the accumulation
+        // field and the time integrators would leave them behind member 0
+        if (volume || input_info.contains("TimeStepping") || input_info.contains("Implicit")) {
+            runtime->print_once(ctx, stderr, "Ensembles are not supported with Residual.volume, "
+                "[TimeStepping] or [Implicit]\n");
+            exit(EXIT_FAILURE);
+        }
+        solution_data.use_ensemble(toml::find<vector<rtype>>(input_info, "Ensemble", "scales"));
+        msg.str(std::string());
+        msg << "Ensemble of " << solution_data.nMember << " members" << endl;
+        runtime->print_once(ctx, stdout, msg.str().c_str());
+    }
+
+    // one evaluation of the residual of the current state
+    auto evaluate_residual = [&](const Predicate &pred) {
+        if (volume) solution_data.compute_volume_residual(nIter, geometry_data, pred);
+        if (trace_only) {
+            solution_data.compute_iface_residual_trace(nIter, mesh_data, geometry_data, pred);
+        }
+        else {
+            solution_data.compute_iface_residual(nIter, mesh_data, geometry_data, pred);
+        }
+        solution_data.compute_bface_residual(nIter, mesh_data, pred);
+        solution_data.accumulate_face_residual(pred);
+    };
 
-    for (int i=0; i<nIter; i++) {
-        solution_data.compute_iface_residual(nIter, mesh_data);
+    // explicit time stepping, each iteration is then a time step instead of a residual evaluation
+    unique_ptr<TimeIntegrator> integrator;
+    if (input_info.contains("TimeStepping")) {
+        integrator.reset(new TimeIntegrator(ctx, runtime, logger, solution_data,
+            toml::find<string>(input_info, "TimeStepping", "scheme"),
+            toml::find<rtype>(input_info, "TimeStepping", "dt")));
+    }
+
+    // implicit (backward Euler) time stepping with a matrix-free Newton-GMRES solver
+    unique_ptr<NewtonKrylov> implicit;
+    if (input_info.contains("Implicit")) {
+        const auto &implicit_info = toml::find(input_info, "Implicit");
+        implicit.reset(new NewtonKrylov(ctx, runtime, logger, solution_data,
+            toml::find<rtype>(implicit_info, "dt"),
+            toml::find<int>(implicit_info, "krylov_size"),
+            toml::find<int>(implicit_info, "newton_iterations"),
+            toml::find<rtype>(implicit_info, "newton_tolerance"),
+            toml::find<rtype>(implicit_info, "gmres_tolerance"),
+            implicit_info.contains("eps") ? toml::find<rtype>(implicit_info, "eps")
+                : sqrt(numeric_limits<stype>::epsilon())));
+    }
+
+    // element-block Jacobian in block-CSR format, assembled once
+    unique_ptr<JacobianData> jacobian_data;
+    if (input_info.contains("Jacobian")) {
+        jacobian_data.reset(new JacobianData(ctx, runtime, logger));
+        jacobian_data->create_jacobian_region(mesh, mesh_data);
+        jacobian_data->assemble(toml::find<rtype>(input_info, "Jacobian", "shift"), mesh_data);
+        msg.str(std::string());
+        msg << "Jacobian assembled with " << jacobian_data->nBlock << " off-diagonal blocks"
+            << endl;
+        runtime->print_once(ctx, stdout, msg.str().c_str());
+    }
+
+    // partition-local preconditioner of the implicit solves, factored once from the Jacobian
+    unique_ptr<Preconditioner> preconditioner;
+    if (implicit && toml::find(input_info, "Implicit").contains("preconditioner")) {
+        if (!jacobian_data) {
+            runtime->print_once(ctx, stderr, "The preconditioner needs a [Jacobian] section\n");
+            exit(EXIT_FAILURE);
+        }
+        preconditioner.reset(new Preconditioner(ctx, runtime, logger, *jacobian_data,
+            toml::find<string>(input_info, "Implicit", "preconditioner")));
+        preconditioner->factor();
+        implicit->set_preconditioner(preconditioner.get());
+        char msg2[100];
+        sprintf(msg2, "Preconditioner: |v - J M^-1 v|/|v| = %.10e for v = 1\n",
+            implicit->preconditioner_defect(*jacobian_data));
+        runtime->print_once(ctx, stdout, msg2);
+    }
+
+    // steady p-multigrid solve of the model problem, before the iterations
+    if (input_info.contains("Multigrid")) {
+        const auto &mg_info = toml::find(input_info, "Multigrid");
+        PMultigrid multigrid(ctx, runtime, logger, mesh_data, solution_data,
+            toml::find<int>(mg_info, "p_min"), toml::find<int>(mg_info, "nu1"),
+            toml::find<int>(mg_info, "nu2"), toml::find<int>(mg_info, "nu_coarse"),
+            toml::find<rtype>(mg_info, "omega"), toml::find<rtype>(mg_info, "sigma"));
+        int cycles = multigrid.solve(toml::find<int>(mg_info, "cycles"),
+            toml::find<rtype>(mg_info, "tolerance"));
+        msg.str(std::string());
+        msg << "p-multigrid done after " << cycles << " cycles" << endl;
+        runtime->print_once(ctx, stdout, msg.str().c_str());
+    }
+
+    auto advance = [&](const Predicate &pred) {
+        if (implicit) implicit->step(evaluate_residual, pred);
+        else if (integrator) integrator->step(evaluate_residual, pred);
+        else evaluate_residual(pred);
+    };
+
+    // checkpoint/restart
+    int first_iter = 0;
+    int checkpoint_frequency = 0;
+    string checkpoint_file;
+    if (input_info.contains("Checkpoint")) {
+        checkpoint_file = toml::find<string>(input_info, "Checkpoint", "file");
+        checkpoint_frequency = toml::find<int>(input_info, "Checkpoint", "frequency");
+        if (toml::find<bool>(input_info, "Checkpoint", "restart")) {
+            first_iter = solution_data.restart(checkpoint_file) + 1;
+            msg.str(std::string());
+            msg << "Restarted from " << checkpoint_file << " after iteration " << first_iter - 1
+                << endl;
+            runtime->print_once(ctx, stdout, msg.str().c_str());
+        }
+    }
+
+    // snapshots of the residual
+    int output_frequency = 0;
+    unique_ptr<SolutionOutput> output;
+    if (input_info.contains("Output")) {
+        output_frequency = toml::find<int>(input_info, "Output", "frequency");
+        output.reset(new SolutionOutput(ctx, runtime, logger, mesh, solution_data,
+            toml::find<string>(input_info, "Output", "prefix"),
+            toml::find<int>(input_info, "Output", "in_flight")));
+    }
+
+    // residual published in shared memory for in-situ consumers
+    int shm_frequency = 0;
+    string shm_prefix;
+    if (input_info.contains("SharedMemory")) {
+        shm_frequency = toml::find<int>(input_info, "SharedMemory", "frequency");
+        shm_prefix = toml::find<string>(input_info, "SharedMemory", "prefix");
+    }
+
+    // deferred verification that the residual grows linearly, reported at the end of the run
+    int verify_frequency = 0;
+    vector<Future> verify_failures;
+    if (input_info.contains("Verification")) {
+        verify_frequency = toml::find<int>(input_info, "Verification", "frequency");
+        if (integrator || implicit || input_info.contains("Convergence") || first_iter > 0) {
+            runtime->print_once(ctx, stderr, "Verification needs plain residual iterations from "
+                "the start, without time stepping, convergence monitoring or restart\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (input_info.contains("Convergence")) {
+        // iterations are issued speculatively under the predicate of the last pushed norm, nIter
+        // acts as a cap
+        auto tolerance = toml::find<rtype>(input_info, "Convergence", "tolerance");
+        auto frequency = toml::find<int>(input_info, "Convergence", "frequency");
+        if (frequency < 1) {
+            runtime->print_once(ctx, stderr, "Convergence.frequency must be at least 1\n");
+            exit(EXIT_FAILURE);
+        }
+        auto lag = toml::find<int>(input_info, "Convergence", "lag");
+        ConvergenceMonitor monitor(ctx, runtime, logger, tolerance, lag);
+        int i = first_iter;
+        for (; i<nIter && !monitor.poll(); i++) {
+            advance(monitor.predicate());
+            if ((i+1)%frequency == 0) monitor.push(i, solution_data.compute_residual_norm());
+            if (checkpoint_frequency>0 && (i+1)%checkpoint_frequency == 0) {
+                solution_data.checkpoint(checkpoint_file, i);
+            }
+            if (output_frequency>0 && (i+1)%output_frequency == 0) output->dump(i);
+            if (shm_frequency>0 && (i+1)%shm_frequency == 0) {
+                solution_data.publish_shm(shm_prefix, i);
+            }
+        }
+        monitor.drain();
+        msg.str(std::string());
+        msg << "Issued " << i - first_iter << " iterations, ";
+        if (monitor.converged) {
+            msg << "converged at iteration " << monitor.converged_iteration << endl;
+        }
+        else {
+            msg << "not converged" << endl;
+        }
+        runtime->print_once(ctx, stdout, msg.str().c_str());
+    }
+    else {
+        for (int i=first_iter; i<nIter; i++) {
+            advance(Predicate::TRUE_PRED);
+            if (verify_frequency>0 && i == 0) solution_data.copy_to_reference();
+            if (verify_frequency>0 && (i+1)%verify_frequency == 0) {
+                verify_failures.push_back(solution_data.check(i, nIter));
+            }
+            if (checkpoint_frequency>0 && (i+1)%checkpoint_frequency == 0) {
+                solution_data.checkpoint(checkpoint_file, i);
+            }
+            if (output_frequency>0 && (i+1)%output_frequency == 0) output->dump(i);
+            if (shm_frequency>0 && (i+1)%shm_frequency == 0) {
+                solution_data.publish_shm(shm_prefix, i);
+            }
+        }
     }
     rtype sum = solution_data.compute_error();
     char msg2[1000];
     sprintf(msg2, "Error = %.10e\n", sum);
     runtime->print_once(ctx, stdout, msg2);
+    for (int m=1; m<solution_data.nMember; m++) {
+        sum = solution_data.compute_error(SolutionData::FID_SOL_ENSEMBLE + m);
+        sprintf(msg2, "Error of member %d = %.10e\n", m, sum);
+        runtime->print_once(ctx, stdout, msg2);
+    }
+    if (verify_frequency > 0) {
+        int nFailure = 0;
+        for (auto &failures: verify_failures) nFailure += failures.get_result<int>();
+        sprintf(msg2, "Verification: %d checks, %d failing residual entries\n",
+            (int) verify_failures.size(), nFailure);
+        runtime->print_once(ctx, nFailure > 0 ? stderr : stdout, msg2);
+    }
+
+    // the trace exchange must give the residual of the full halo path, up to the summation order
+    if (verify_frequency > 0 && trace_only) {
+        rtype trace_error = solution_data.compute_error();
+        trace_only = false;
+        solution_data.zero_field();
+        for (int i=0; i<nIter; i++) evaluate_residual(Predicate::TRUE_PRED);
+        rtype halo_error = solution_data.compute_error();
+        trace_only = true;
+        bool match = fabs(trace_error - halo_error)
+            <= 16*nIter*numeric_limits<stype>::epsilon()*fabs(halo_error);
+        sprintf(msg2, "Verification: trace exchange Error = %.10e, full halo Error = %.10e%s\n",
+            trace_error, halo_error, match ? "" : " (mismatch)");
+        runtime->print_once(ctx, match ? stdout : stderr, msg2);
+    }
+
+    // stress mode: repeat whole runs in the same runtime, each one must match the first bitwise
+    if (input_info.contains("Stress")) {
+        auto repeats = toml::find<int>(input_info, "Stress", "repeats");
+        rtype first = 0.;
+        int r = 0;
+        for (; r<repeats; r++) {
+            solution_data.zero_field();
+            for (int i=0; i<nIter; i++) advance(Predicate::TRUE_PRED);
+            rtype error = solution_data.compute_error();
+            if (r == 0) first = error;
+            else if (memcmp(&error, &first, sizeof(rtype)) != 0) {
+                sprintf(msg2, "Stress run %d diverged: Error = %.17e (%a), first run %.17e (%a)\n",
+                    r, error, error, first, first);
+                runtime->print_once(ctx, stderr, msg2);
+                break;
+            }
+        }
+        sprintf(msg2, "Stress: %d of %d runs matched the first one bitwise, Error = %.10e\n",
+            r, repeats, first);
+        runtime->print_once(ctx, stdout, msg2);
+    }
 
+    if (output) output->wait_all();
+    output.reset();
+    preconditioner.reset();
+    jacobian_data.reset();
     solution_data.clean_up();
+    geometry_data.clean_up();
     mesh_data.clean_up();
 }
 
@@ -59,8 +358,21 @@ int main(int argc, char *argv[]) {
         Runtime::preregister_task_variant<top_level_task> (registrar, "top_level_task");
     }
 
+    MeshData::register_tasks();
+    GeometryData::register_tasks();
     SolutionData::register_tasks();
-    Runtime::register_reduction_op<ReductionSum<N_REDOP>>(1);
+    ConvergenceMonitor::register_tasks();
+    TimeIntegrator::register_tasks();
+    NewtonKrylov::register_tasks();
+    JacobianData::register_tasks();
+    Preconditioner::register_tasks();
+    PMultigrid::register_tasks();
+    SolutionOutput::register_tasks();
+    Runtime::register_reduction_op<ReductionSum<N_REDOP, stype>>(REDOP_SUM_ID);
+    Runtime::register_reduction_op<ReductionSum<N_BLOCK>>(REDOP_BLOCK_SUM_ID);
+#ifdef REPRODUCIBLE
+    Runtime::register_reduction_op<ReductionSuperSum>(REDOP_SUPER_SUM_ID);
+#endif
 
     return Runtime::start(argc, argv);
 }
\ No newline at end of file
@@ -3,11 +3,19 @@
 //
 
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <string>
+#include <utility>
+#include <vector>
 #include "H5Cpp.h"
 #include "metis.h"
 #include "toml11/toml.hpp"
+#include "basis.h"
 #include "mesh.h"
 
 using namespace std;
@@ -24,20 +32,94 @@ const string DSET_ELEM_TO_NODES("Elem2Nodes");
 const string DSET_IFACE("IFaceData");
 const string DSET_QORDER("QOrder");
 
-Mesh::Mesh(const toml::value &input_info) : partitioned(false) {
-    string mesh_file_name = toml::find<string>(input_info, "Mesh", "file");
-    if (input_info.contains("Boundaries")) {
-        BFG_names = toml::find<vector<string>>(input_info, "Boundaries", "names");
+/*! \brief Local indices of the corner nodes lying on a face of an element
+ *
+ * Nodes are ordered lexicographically.
+ */
+static vector<int> face_corner_nodes(const int dim, const int order, const int face) {
+    int d, side;
+    face_direction(dim, face, d, side);
+    int n1 = order + 1;
+    vector<int> corners;
+    for (int corner=0; corner<(1<<dim); corner++) {
+        if (((corner>>d) & 1) != side) continue;
+        int inode = 0, stride = 1;
+        for (int dd=0; dd<dim; dd++, stride*=n1) inode += ((corner>>dd) & 1)*order*stride;
+        corners.push_back(inode);
+    }
+    return corners;
+}
+
+/*! \brief Identifier of a point of a refined parent lattice, independent of the parent
+ *
+ * Parent corner nodes with a non-zero multilinear weight at the point, sorted, and the weights.
+ */
+struct LatticeKey {
+    int node[8]; //!< corner node IDs, -1 past the last one
+    int weight[8]; //!< integer weights of the corners
+    int64_t point; //!< lattice point, ielem*nLat + p
+
+    /*! \brief Sort the first n corners by node ID and clear the others
+     *
+     */
+    void sort(const int n) {
+        for (int i=1; i<n; i++) {
+            for (int j=i; j>0 && node[j] < node[j-1]; j--) {
+                swap(node[j], node[j-1]);
+                swap(weight[j], weight[j-1]);
+            }
+        }
+        for (int i=n; i<8; i++) node[i] = weight[i] = -1;
+    }
+
+    bool same_point(const LatticeKey &other) const {
+        return equal(node, node + 8, other.node) && equal(weight, weight + 8, other.weight);
+    }
+
+    /*! \brief Order by point identifier, then by lattice point
+     *
+     */
+    bool operator<(const LatticeKey &other) const {
+        if (!equal(node, node + 8, other.node)) {
+            return lexicographical_compare(node, node + 8, other.node, other.node + 8);
+        }
+        if (!equal(weight, weight + 8, other.weight)) {
+            return lexicographical_compare(weight, weight + 8, other.weight, other.weight + 8);
+        }
+        return point < other.point;
+    }
+};
+
+Mesh::Mesh(const toml::value &input_info) : partitioned(false), lattice_faces(false) {
+    if (input_info.contains("Generate")) {
+        const auto &gen_info = toml::find(input_info, "Generate");
+        int nz = gen_info.contains("nz") ? toml::find<int>(gen_info, "nz") : 0;
+        rtype perturbation = gen_info.contains("perturbation") ?
+            toml::find<rtype>(gen_info, "perturbation") : 0.;
+        generate(toml::find<int>(gen_info, "nx"), toml::find<int>(gen_info, "ny"), nz,
+            toml::find<int>(gen_info, "order"), perturbation);
     }
     else {
-        BFG_names.resize(0);
-        nBFG = 0;
-        nBFace = 0;
+        string mesh_file_name = toml::find<string>(input_info, "Mesh", "file");
+        if (input_info.contains("Boundaries")) {
+            BFG_names = toml::find<vector<string>>(input_info, "Boundaries", "names");
+        }
+        else {
+            BFG_names.resize(0);
+            nBFG = 0;
+            nBFace = 0;
+        }
+        read_mesh(mesh_file_name);
     }
-    read_mesh(mesh_file_name);
+
+    // uniform refinement
+    const auto &mesh_info = toml::find(input_info, "Mesh");
+    int nRefine = mesh_info.contains("refine") ? toml::find<int>(mesh_info, "refine") : 0;
+    for (int i=0; i<nRefine; i++) refine();
 }
 
 void Mesh::read_mesh(const string &mesh_file_name) {
+    lattice_faces = false;
 //    try {
         // turn off the auto-printing when failure occurs
         hsize_t dims[2]; // buffer to store size in each dimensions
@@ -181,6 +263,9 @@ void Mesh::read_mesh(const string &mesh_file_name) {
 //    catch( DataSpaceIException error ) {
 //        error.printErrorStack();
 //    }
+
+    // the face metrics and the face node lookups take face IDs as face_id() directions
+    normalize_face_ids();
 }
 
 void Mesh::read_boundary_faces(H5::H5File &file) {
@@ -226,6 +311,406 @@ void Mesh::read_boundary_faces(H5::H5File &file) {
     }
 }
 
+void Mesh::check_size(const int64_t nElem_, const int64_t nNode_, const int64_t nIface_,
+                      const int64_t nEind) {
+    const int64_t int_max = numeric_limits<int>::max();
+    if (nElem_ > int_max || nNode_ > int_max || nIface_ > int_max) {
+        cerr << "Mesh too large: " << nElem_ << " elements, " << nNode_ << " nodes and " << nIface_
+             << " interior faces, IDs are limited to " << int_max << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (nEind > (int64_t) numeric_limits<idx_t>::max()) {
+        cerr << "Mesh too large: " << nEind << " element nodes, metis was built with "
+             << 8*sizeof(idx_t) << "-bit idx_t" << endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+void Mesh::generate(const int nx, const int ny, const int nz, const int order_,
+                    const rtype perturbation) {
+    dim = nz>0 ? 3 : 2;
+    order = order_;
+    int nCell[3] = {nx, ny, dim==3 ? nz : 1};
+    int nNode_dir[3]; // number of nodes per direction
+    for (int d=0; d<3; d++) nNode_dir[d] = order*nCell[d] + 1;
+    if (dim == 2) nNode_dir[2] = 1;
+    int n1 = order + 1; // number of nodes per direction in an element
+
+    // counts are checked in 64 bits: element, node and face IDs are int and metis indexes eind
+    // with idx_t
+    nNode_per_elem = dim==3 ? n1*n1*n1 : n1*n1;
+    int64_t nElem64 = (int64_t) nCell[0]*nCell[1]*nCell[2];
+    int64_t nNode64 = (int64_t) nNode_dir[0]*nNode_dir[1]*nNode_dir[2];
+    check_size(nElem64, nNode64, dim*nElem64, nElem64*nNode_per_elem);
+    nElem = nElem64;
+    nNode = nNode64;
+    nIface = dim*nElem;
+    BFG_names.resize(0);
+    nBFG = 0;
+    nBFace = 0;
+
+    // node coordinates
+    const rtype pi = 3.14159265358979323846;
+    coord.resize(nNode);
+    for (int k=0; k<nNode_dir[2]; k++) {
+        for (int j=0; j<nNode_dir[1]; j++) {
+            for (int i=0; i<nNode_dir[0]; i++) {
+                int ijk[3] = {i, j, k};
+                vector<rtype> x(dim);
+                for (int d=0; d<dim; d++) x[d] = (rtype) ijk[d] / (rtype) (order*nCell[d]);
+                // smooth field vanishing on the boundary
+                rtype bump = 1.;
+                for (int d=0; d<dim; d++) bump *= sin(2.*pi*x[d]);
+                vector<rtype> &xp = coord[i + nNode_dir[0]*(j + nNode_dir[1]*k)];
+                xp.resize(dim);
+                for (int d=0; d<dim; d++) {
+                    xp[d] = x[d] + perturbation/(rtype) nCell[d]*bump;
+                }
+            }
+        }
+    }
+
+    // element to nodes
+    eptr.resize((size_t) nElem + 1);
+    eind.resize((size_t) nElem*nNode_per_elem);
+    for (int ielem=0; ielem<nElem+1; ielem++) eptr[ielem] = (idx_t) ielem*nNode_per_elem;
+    for (int k=0; k<nCell[2]; k++) {
+        for (int j=0; j<nCell[1]; j++) {
+            for (int i=0; i<nCell[0]; i++) {
+                int ielem = i + nCell[0]*(j + nCell[1]*k);
+                int inode = 0;
+                for (int c=0; c<(dim==3 ? n1 : 1); c++) {
+                    for (int b=0; b<n1; b++) {
+                        for (int a=0; a<n1; a++, inode++) {
+                            int I = order*i + a, J = order*j + b, K = order*k + c;
+                            eind[eptr[ielem] + inode] = I + nNode_dir[0]*(J + nNode_dir[1]*K);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // interior faces, from each element to its neighbor in +x, +y (and +z), periodically
+    IFace_to_elem.resize(nIface);
+    elem_num_IFace.assign(nElem, 0);
+    elem_to_IFace.assign(nElem, vector<int>(6));
+    elem_num_BFace.assign(nElem, 0);
+    elem_to_BFace.assign(nElem, vector<int>(6));
+    int iface = 0;
+    for (int k=0; k<nCell[2]; k++) {
+        for (int j=0; j<nCell[1]; j++) {
+            for (int i=0; i<nCell[0]; i++) {
+                int ijk[3] = {i, j, k};
+                int elemL = i + nCell[0]*(j + nCell[1]*k);
+                for (int d=0; d<dim; d++, iface++) {
+                    int nbr[3] = {i, j, k};
+                    nbr[d] = (ijk[d] + 1) % nCell[d];
+                    int elemR = nbr[0] + nCell[0]*(nbr[1] + nCell[1]*nbr[2]);
+                    IFace_to_elem[iface] = {elemL, face_id(dim, d, 1), 0,
+                                            elemR, face_id(dim, d, 0), 0};
+                    elem_to_IFace[elemL][elem_num_IFace[elemL]++] = iface;
+                    elem_to_IFace[elemR][elem_num_IFace[elemR]++] = iface;
+                }
+            }
+        }
+    }
+
+    // resize partition ID container
+    elem_part_id.resize(nElem);
+    node_part_id.resize(nNode);
+    partitioned = false;
+    lattice_faces = true;
+}
+
+void Mesh::normalize_face_ids() {
+    if (lattice_faces) return;
+    const int nCorner = 1<<dim;
+    const int n1 = order + 1;
+    // node of a corner of an element, bit d of corner giving its end in direction d
+    auto corner_node = [&](const int ielem, const int corner) {
+        int inode = 0, stride = 1;
+        for (int d=0; d<dim; d++, stride*=n1) inode += ((corner>>d) & 1)*order*stride;
+        return eind[eptr[ielem] + inode];
+    };
+
+    // a face whose corners are shared by its two elements gives the direction and side of its face
+    // ID on both sides, periodic faces share no nodes and are skipped, as are pairs of elements
+    // connected by several faces (periodic direction of two elements) whose shared nodes may lie
+    // on another face
+    map<pair<int, int>, int> pair_count;
+    for (auto &f: IFace_to_elem) pair_count[make_pair(min(f[0], f[3]), max(f[0], f[3]))]++;
+    map<int, int> to_lattice;
+    bool conflict = false;
+    auto learn = [&](const int face, const int d, const int side) {
+        auto it = to_lattice.find(face);
+        if (it == to_lattice.end()) to_lattice[face] = face_id(dim, d, side);
+        else if (it->second != face_id(dim, d, side)) conflict = true;
+    };
+    for (int iface=0; iface<nIface; iface++) {
+        const vector<int> &f = IFace_to_elem[iface];
+        if (pair_count[make_pair(min(f[0], f[3]), max(f[0], f[3]))] > 1) continue;
+        int sharedL = 0, sharedR = 0, nShared = 0;
+        for (int cL=0; cL<nCorner; cL++) {
+            for (int cR=0; cR<nCorner; cR++) {
+                if (corner_node(f[0], cL) != corner_node(f[3], cR)) continue;
+                sharedL |= 1<<cL;
+                sharedR |= 1<<cR;
+                nShared++;
+            }
+        }
+        if (nShared != nCorner/2) continue;
+        for (int lr=0; lr<2; lr++) {
+            int shared = lr==0 ? sharedL : sharedR;
+            for (int d=0; d<dim; d++) {
+                for (int side=0; side<2; side++) {
+                    int on_face = 0;
+                    for (int c=0; c<nCorner; c++) {
+                        if (((c>>d) & 1) == side) on_face |= 1<<c;
+                    }
+                    if (on_face == shared) learn(f[1 + 3*lr], d, side);
+                }
+            }
+        }
+    }
+
+    bool complete = !conflict;
+    for (auto &f: IFace_to_elem) {
+        complete = complete && to_lattice.count(f[1]) && to_lattice.count(f[4]);
+    }
+    for (auto &group: BFG_to_data) {
+        for (auto &bface: group.second) complete = complete && to_lattice.count(bface[1]);
+    }
+    if (!complete) {
+        cerr << "The face IDs of the mesh could not be mapped consistently to directions, every "
+             << "face ID must appear on an interior face whose elements share nodes" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    for (auto &f: IFace_to_elem) {
+        f[1] = to_lattice[f[1]];
+        f[4] = to_lattice[f[4]];
+    }
+    for (auto &group: BFG_to_data) {
+        for (auto &bface: group.second) bface[1] = to_lattice[bface[1]];
+    }
+    lattice_faces = true;
+}
+
+bool Mesh::aligned_faces() const {
+    if (!lattice_faces) return false;
+    for (auto &f: IFace_to_elem) {
+        if (f[2] != 0 || f[5] != 0) return false;
+    }
+    return true;
+}
+
+void Mesh::refine() {
+    normalize_face_ids();
+
+    const int n1 = order + 1; // nodes per direction in an element
+    const int m = 2*order; // intervals per direction of the refined lattice of a parent
+    const int nLat1 = m + 1; // refined lattice points per direction
+    const int nLat = dim==3 ? nLat1*nLat1*nLat1 : nLat1*nLat1;
+    const int nChild = 1<<dim;
+    const int nCorner = 1<<dim;
+
+    int64_t nElem_new64 = (int64_t) nElem*nChild;
+    int64_t nIface_new64 = ((int64_t) nIface + (int64_t) dim*nElem)*(nChild/2);
+    check_size(nElem_new64, 0, nIface_new64, nElem_new64*nNode_per_elem);
+
+    // place the refined lattice of each parent from its geometry (curved for order 2); a point on
+    // the boundary of its parent may be seen from several parents and gets a key made of the parent
+    // corners and the integer multilinear weights of the point with respect to them, which does not
+    // depend on the parent, interior points are unique
+    vector<rtype> lat_x((size_t) nElem*nLat*dim, 0.);
+    vector<LatticeKey> keys;
+    vector<rtype> phi[3];
+    for (int d=0; d<3; d++) phi[d].resize(n1);
+    for (int ielem=0; ielem<nElem; ielem++) {
+        for (int p=0; p<nLat; p++) {
+            int lat[3] = {p%nLat1, (p/nLat1)%nLat1, dim==3 ? p/(nLat1*nLat1) : 0};
+            rtype *x = &lat_x[((size_t) ielem*nLat + p)*dim];
+            for (int d=0; d<dim; d++) lagrange_1d(order, (rtype) lat[d]/(rtype) m, phi[d].data());
+            for (int inode=0; inode<nNode_per_elem; inode++) {
+                int a[3] = {inode%n1, (inode/n1)%n1, dim==3 ? inode/(n1*n1) : 0};
+                rtype w = 1.;
+                for (int d=0; d<dim; d++) w *= phi[d][a[d]];
+                const vector<rtype> &xn = coord[eind[eptr[ielem] + inode]];
+                for (int d=0; d<dim; d++) x[d] += w*xn[d];
+            }
+
+            LatticeKey key;
+            key.point = (int64_t) ielem*nLat + p;
+            int nWeight = 0;
+            for (int corner=0; corner<nCorner; corner++) {
+                int w = 1;
+                int inode = 0, stride = 1;
+                for (int d=0; d<dim; d++, stride*=n1) {
+                    int bit = (corner>>d) & 1;
+                    w *= bit ? lat[d] : m - lat[d];
+                    inode += bit*order*stride;
+                }
+                if (w == 0) continue;
+                key.node[nWeight] = eind[eptr[ielem] + inode];
+                key.weight[nWeight] = w;
+                nWeight++;
+            }
+            if (nWeight == nCorner) continue; // interior point
+            key.sort(nWeight);
+            keys.push_back(key);
+        }
+    }
+
+    // number the refined nodes in the order they are met, a boundary point taking the ID of the
+    // first point with the same key
+    sort(keys.begin(), keys.end());
+    vector<int64_t> first(lat_x.size()/dim);
+    for (size_t i=0; i<first.size(); i++) first[i] = i;
+    for (size_t i=0, j=0; i<keys.size(); i=j) {
+        for (j=i+1; j<keys.size() && keys[j].same_point(keys[i]); j++) {}
+        for (size_t k=i+1; k<j; k++) first[keys[k].point] = keys[i].point;
+    }
+    vector<LatticeKey>().swap(keys);
+    int64_t nNode_new64 = 0;
+    for (size_t i=0; i<first.size(); i++) nNode_new64 += first[i] == (int64_t) i;
+    check_size(nElem_new64, nNode_new64, nIface_new64, 0);
+    vector<int> lat_node(first.size());
+    vector<vector<rtype>> new_coord;
+    new_coord.reserve(nNode_new64);
+    for (size_t i=0; i<first.size(); i++) {
+        if (first[i] != (int64_t) i) {
+            lat_node[i] = lat_node[first[i]];
+            continue;
+        }
+        lat_node[i] = new_coord.size();
+        new_coord.push_back(vector<rtype>(lat_x.begin() + i*dim, lat_x.begin() + (i+1)*dim));
+    }
+    vector<int64_t>().swap(first);
+    vector<rtype>().swap(lat_x);
+
+    // children, numbered ielem*nChild + child with child = ci + 2*cj + 4*ck
+    int nElem_new = nElem_new64;
+    vector<idx_t> eptr_new((size_t) nElem_new + 1);
+    vector<idx_t> eind_new((size_t) nElem_new*nNode_per_elem);
+    for (int ielem=0; ielem<nElem_new+1; ielem++) eptr_new[ielem] = (idx_t) ielem*nNode_per_elem;
+    for (int ielem=0; ielem<nElem; ielem++) {
+        for (int child=0; child<nChild; child++) {
+            idx_t *nodes = &eind_new[eptr_new[ielem*nChild + child]];
+            for (int inode=0; inode<nNode_per_elem; inode++) {
+                int a[3] = {inode%n1, (inode/n1)%n1, dim==3 ? inode/(n1*n1) : 0};
+                int p = 0, stride = 1;
+                for (int d=0; d<dim; d++, stride*=nLat1) {
+                    p += (((child>>d) & 1)*order + a[d])*stride;
+                }
+                nodes[inode] = lat_node[(size_t) ielem*nLat + p];
+            }
+        }
+    }
+
+    // centroid of the corners of a face, from the old or the refined nodes
+    auto face_centroid = [&](const vector<idx_t> &ind, const vector<idx_t> &ptr,
+                             const vector<vector<rtype>> &x, const int ielem, const int face) {
+        vector<int> corners = face_corner_nodes(dim, order, face);
+        vector<rtype> c(dim, 0.);
+        for (int corner: corners) {
+            for (int d=0; d<dim; d++) c[d] += x[ind[ptr[ielem] + corner]][d] / corners.size();
+        }
+        return c;
+    };
+
+    // interior faces
+    vector<vector<int>> iface_new;
+    for (int ielem=0; ielem<nElem; ielem++) {
+        // between the children of a parent
+        for (int d=0; d<dim; d++) {
+            for (int child=0; child<nChild; child++) {
+                if ((child>>d) & 1) continue;
+                iface_new.push_back({ielem*nChild + child, face_id(dim, d, 1), 0,
+                                     ielem*nChild + (child | (1<<d)), face_id(dim, d, 0), 0});
+            }
+        }
+    }
+    for (int iface=0; iface<nIface; iface++) {
+        // split parent faces, children of the right element are matched by position after
+        // translating by the offset between the parent faces (non-zero for periodic faces)
+        const vector<int> &f = IFace_to_elem[iface];
+        int dL, sL, dR, sR;
+        face_direction(dim, f[1], dL, sL);
+        face_direction(dim, f[4], dR, sR);
+        vector<rtype> cL = face_centroid(eind, eptr, coord, f[0], f[1]);
+        vector<rtype> cR = face_centroid(eind, eptr, coord, f[3], f[4]);
+        for (int childL=0; childL<nChild; childL++) {
+            if (((childL>>dL) & 1) != sL) continue;
+            vector<rtype> c = face_centroid(eind_new, eptr_new, new_coord,
+                f[0]*nChild + childL, f[1]);
+            int best = -1;
+            rtype best_dist = 0.;
+            for (int childR=0; childR<nChild; childR++) {
+                if (((childR>>dR) & 1) != sR) continue;
+                vector<rtype> cc = face_centroid(eind_new, eptr_new, new_coord,
+                    f[3]*nChild + childR, f[4]);
+                rtype dist = 0.;
+                for (int d=0; d<dim; d++) {
+                    rtype delta = c[d] + cR[d] - cL[d] - cc[d];
+                    dist += delta*delta;
+                }
+                if (best < 0 || dist < best_dist) {
+                    best = childR;
+                    best_dist = dist;
+                }
+            }
+            iface_new.push_back({f[0]*nChild + childL, f[1], f[2],
+                                 f[3]*nChild + best, f[4], f[5]});
+        }
+    }
+
+    // boundary faces
+    int ibface_global = 0;
+    elem_num_BFace.assign(nElem_new, 0);
+    elem_to_BFace.assign(nElem_new, vector<int>(6));
+    for (string BFG_name: BFG_names) {
+        vector<vector<int>> bfaces;
+        for (const vector<int> &bface: BFG_to_data[BFG_name]) {
+            int d, side;
+            face_direction(dim, bface[1], d, side);
+            for (int child=0; child<nChild; child++) {
+                if (((child>>d) & 1) != side) continue;
+                int elem = bface[0]*nChild + child;
+                bfaces.push_back({elem, bface[1], bface[2]});
+                elem_to_BFace[elem][elem_num_BFace[elem]] = ibface_global;
+                elem_num_BFace[elem]++;
+                ibface_global++;
+            }
+        }
+        BFG_to_nBFace[BFG_name] = bfaces.size();
+        BFG_to_data[BFG_name].swap(bfaces);
+    }
+    nBFace = ibface_global;
+
+    // swap in the refined mesh
+    nElem = nElem_new;
+    nNode = new_coord.size();
+    nIface = iface_new.size();
+    coord.swap(new_coord);
+    eptr.swap(eptr_new);
+    eind.swap(eind_new);
+    IFace_to_elem.swap(iface_new);
+    elem_num_IFace.assign(nElem, 0);
+    elem_to_IFace.assign(nElem, vector<int>(6));
+    for (int iface=0; iface<nIface; iface++) {
+        int elemL = IFace_to_elem[iface][0];
+        int elemR = IFace_to_elem[iface][3];
+        elem_to_IFace[elemL][elem_num_IFace[elemL]++] = iface;
+        elem_to_IFace[elemR][elem_num_IFace[elemR]++] = iface;
+    }
+
+    // resize partition ID container
+    elem_part_id.resize(nElem);
+    node_part_id.resize(nNode);
+    partitioned = false;
+}
+
 void Mesh::partition(int nparts) {
     idx_t objval;
     idx_t ncommon = 1;
@@ -240,6 +725,16 @@ void Mesh::partition(int nparts) {
     this->partitioned = true;
 }
 
+vector<int> Mesh::corner_nodes() const {
+    int n1 = order + 1; // nodes per direction
+    vector<int> corners{0, order, n1*n1 - 1, order*n1};
+    if (dim == 3) {
+        int offset = order*n1*n1;
+        for (int i=0; i<4; i++) corners.push_back(corners[i] + offset);
+    }
+    return corners;
+}
+
 ostream& operator<<(ostream& os, const Mesh& mesh) {
     os << endl << string(80, '=') << endl;
     os << "---> Mesh info" << endl;
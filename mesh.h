@@ -5,6 +5,7 @@
 #ifndef DG_MESH_H
 #define DG_MESH_H
 
+#include <cstdint>
 #include <iostream>
 #include <map>
 #include <string>
@@ -34,16 +35,69 @@ class Mesh {
      *
      * @param mesh_file_name
      *
+     * The face IDs are mapped to the numbering of generate() (see normalize_face_ids()).
      * Currently allowed here for testing.
      */
     void read_mesh(const std::string &mesh_file_name); // TODO: hide this function
 
+    /*! \brief Generate a periodic structured mesh of the unit square/cube in memory
+     *
+     * Elements are quadrilaterals (nz = 0) or hexahedra whose nodes are ordered lexicographically
+     * (x fastest). Faces are numbered as follows:
+     * - quad: 0 (y = 0), 1 (x = 1), 2 (y = 1), 3 (x = 0)
+     * - hex: 0 (z = 0), 1 (y = 0), 2 (x = 1), 3 (y = 1), 4 (x = 0), 5 (z = 1)
+     *
+     * All faces are interior faces (periodic in every direction) with orientation 0. The
+     * perturbation moves the nodes along a smooth field vanishing on the boundary of the domain, so
+     * that periodic faces still match and order 2 elements get curved.
+     *
+     * @param nx number of elements in x
+     * @param ny number of elements in y
+     * @param nz number of elements in z, 0 for a 2D mesh
+     * @param order_ geometric order
+     * @param perturbation amplitude of the node displacement relative to the element size
+     */
+    void generate(const int nx, const int ny, const int nz, const int order_,
+        const rtype perturbation);
+
+    /*! \brief Uniformly refine the mesh
+     *
+     * Each element is split into 2^dim children, the nodes of which are placed by evaluating the
+     * geometry of the parent (curved for order 2). Refined nodes shared by several parents are
+     * merged by sorting keys that identify them independently of the parent. Child faces on a
+     * parent interior face are matched with their counterpart by position, which handles periodic
+     * faces. Boundary faces are split and keep their group. The mesh must be partitioned again
+     * afterwards.
+     *
+     * Nodes are assumed to be ordered lexicographically, as everywhere else. The face IDs follow
+     * the numbering of generate(), loaded meshes being mapped to it on construction (see
+     * normalize_face_ids()).
+     */
+    void refine();
+
     /*! \brief Partition the mesh sequentially using metis
      *
      * @param nparts
      */
     void partition(int nparts);
 
+    /*! \brief Local indices of the corner nodes of an element
+     *
+     * Nodes of an element are assumed to be ordered lexicographically in Elem2Nodes (x fastest).
+     * Corners are returned counter-clockwise, bottom face first for hexahedra.
+     *
+     * @return local indices of the 4 (quad) or 8 (hex) corner nodes
+     */
+    std::vector<int> corner_nodes() const;
+
+    /*! \brief Whether both elements of every interior face see its nodes in the same order
+     *
+     * True when the face IDs follow face_id() (after generate() or refine()) and every interior
+     * face has orientation 0 on both sides, so that the face nodes listed lexicographically by
+     * each element match one to one.
+     */
+    bool aligned_faces() const;
+
     /*! \brief << operator
      *
      * @param os
@@ -91,7 +145,26 @@ class Mesh {
     std::vector<idx_t> node_part_id; //!< vector of partition ID for each node
 
   private:
+    /*! \brief Exit if the mesh sizes do not fit the index types
+     *
+     * @param nElem_ number of elements
+     * @param nNode_ number of nodes
+     * @param nIface_ number of interior faces
+     * @param nEind size of eind, the largest value of eptr
+     */
+    static void check_size(const int64_t nElem_, const int64_t nNode_, const int64_t nIface_,
+                           const int64_t nEind);
+
+    /*! \brief Map the face IDs to the numbering of generate()
+     *
+     * The direction and side of each face ID are found from the interior faces whose elements share
+     * their corner nodes. Exits if a face ID used by the mesh cannot be mapped or is mapped
+     * inconsistently.
+     */
+    void normalize_face_ids();
+
     bool partitioned; //!< boolean indicating whether the mesh is partitioned
+    bool lattice_faces; //!< whether face IDs follow face_id() (generate(), read_mesh())
     void read_boundary_faces(H5::H5File &file); //!< read boundary faces when they exist
 };
 
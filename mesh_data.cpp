@@ -2,38 +2,266 @@
 // Created by kihiro on 1/28/20.
 //
 
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <vector>
 #include "legion.h"
 #include "mesh_data.h"
 #include "mesh.h"
+#include "ids.h"
 #include "typedefs.h"
 
 using namespace Legion;
 using namespace LegionRuntime;
 using namespace std;
 
+/*! \brief Affine read-only accessor for metis' idx_t data
+ *
+ */
+typedef Legion::FieldAccessor< READ_ONLY, idx_t, 1, Legion::coord_t,
+    Realm::AffineAccessor<idx_t, 1, Legion::coord_t> > AffAccROidx;
+
+void init_mesh_node_range_task(const Task *task, const std::vector<PhysicalRegion> &regions,
+                               Context ctx, Runtime *runtime) {
+    MeshInitArgs args = *(const MeshInitArgs *)task->args;
+    const AffAccROidx acc_nodes(regions[0], MeshData::FID_INIT_ELEM_NODES,
+        args.nNode_per_elem*sizeof(idx_t));
+    const AffAccWDRect1 acc_range(regions[1], MeshData::FID_INIT_ELEM_NODE_RANGE);
+    Domain domain = runtime->get_index_space_domain(ctx,
+        task->regions[0].region.get_index_space());
+    for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+        const idx_t *nodes = acc_nodes.ptr(itr.p);
+        idx_t lo = nodes[0], hi = nodes[0];
+        for (int inode=1; inode<args.nNode_per_elem; inode++) {
+            lo = min(lo, nodes[inode]);
+            hi = max(hi, nodes[inode]);
+        }
+        acc_range[itr.p] = Rect<1>(lo, hi);
+    }
+}
+
+void init_mesh_elem_task(const Task *task, const std::vector<PhysicalRegion> &regions,
+                         Context ctx, Runtime *runtime) {
+    MeshInitArgs args = *(const MeshInitArgs *)task->args;
+    int nValue = args.nNode_per_elem*args.dim;
+    const AffAccWDPoint1 acc_partid(regions[0], MeshData::FID_MESH_ELEM_PARTID);
+    const AffAccWDrtype acc_coord(regions[0], MeshData::FID_MESH_ELEM_NODE_COORDS,
+        nValue*sizeof(rtype));
+    const AffAccROidx acc_init_partid(regions[1], MeshData::FID_INIT_ELEM_PARTID);
+    const AffAccROidx acc_nodes(regions[1], MeshData::FID_INIT_ELEM_NODES,
+        args.nNode_per_elem*sizeof(idx_t));
+    // nodes of the piece's elements
+    const AffAccROrtype acc_node_coord(regions[2], MeshData::FID_INIT_NODE_COORDS,
+        args.dim*sizeof(rtype));
+    Domain domain = runtime->get_index_space_domain(ctx,
+        task->regions[0].region.get_index_space());
+    for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+        acc_partid[itr.p] = Point<1>(acc_init_partid[itr.p]);
+        const idx_t *nodes = acc_nodes.ptr(itr.p);
+        rtype *coord = acc_coord.ptr(itr.p);
+        for (int inode=0; inode<args.nNode_per_elem; inode++) {
+            memcpy(coord + inode*args.dim, acc_node_coord.ptr(Point<1>(nodes[inode])),
+                args.dim*sizeof(rtype));
+        }
+    }
+}
+
+void init_mesh_iface_task(const Task *task, const std::vector<PhysicalRegion> &regions,
+                          Context ctx, Runtime *runtime) {
+    AffAccWDPoint1  acc_point[2];
+    acc_point[0] = AffAccWDPoint1(regions[0], MeshData::FID_MESH_IFACE_ELEMLID);
+    acc_point[1] = AffAccWDPoint1(regions[0], MeshData::FID_MESH_IFACE_ELEMRID);
+    const AffAccWDint acc_faceL(regions[0], MeshData::FID_MESH_IFACE_FACEL);
+    const AffAccWDint acc_faceR(regions[0], MeshData::FID_MESH_IFACE_FACER);
+    // left element ID, face ID and orientation followed by the right ones
+    const AffAccROint acc_data(regions[1], MeshData::FID_INIT_IFACE_DATA, 6*sizeof(int));
+    Domain domain = runtime->get_index_space_domain(ctx,
+        task->regions[0].region.get_index_space());
+    for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+        const int *face_data = acc_data.ptr(itr.p);
+        acc_point[0][itr.p] = face_data[0];
+        acc_point[1][itr.p] = face_data[3];
+        acc_faceL[itr.p] = face_data[1];
+        acc_faceR[itr.p] = face_data[4];
+    }
+}
+
+void init_mesh_bface_task(const Task *task, const std::vector<PhysicalRegion> &regions,
+                          Context ctx, Runtime *runtime) {
+    const AffAccWDPoint1 acc_elem(regions[0], MeshData::FID_MESH_BFACE_ELEMID);
+    const AffAccWDint acc_face(regions[0], MeshData::FID_MESH_BFACE_FACE);
+    const AffAccWDPoint1 acc_group(regions[0], MeshData::FID_MESH_BFACE_GROUP);
+    // element ID, face ID and group ID
+    const AffAccROint acc_data(regions[1], MeshData::FID_INIT_BFACE_DATA, 3*sizeof(int));
+    Domain domain = runtime->get_index_space_domain(ctx,
+        task->regions[0].region.get_index_space());
+    for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+        const int *face_data = acc_data.ptr(itr.p);
+        acc_elem[itr.p] = face_data[0];
+        acc_face[itr.p] = face_data[1];
+        acc_group[itr.p] = face_data[2];
+    }
+}
+
+PartitionCount check_elem_partition_task(const Task *task,
+                                         const std::vector<PhysicalRegion> &regions,
+                                         Context ctx, Runtime *runtime) {
+    const AffAccROPoint1 acc_partid(regions[0], MeshData::FID_MESH_ELEM_PARTID);
+    Point<1> color = task->index_point;
+    PartitionCount count = {0, 0, 0};
+    // the pieces are sparse (partition by field), iterate over their points
+    Domain domain = runtime->get_index_space_domain(ctx,
+        task->regions[0].region.get_index_space());
+    for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+        count.nItem++;
+        if (acc_partid[*itr] != color) count.nError++;
+    }
+    return count;
+}
+
+PartitionCount check_halo_partition_task(const Task *task,
+                                         const std::vector<PhysicalRegion> &regions,
+                                         Context ctx, Runtime *runtime) {
+    // faces by left element, faces by right element, then the elements with halo
+    const AffAccROPoint1 acc_elem[2][2] = {
+        {AffAccROPoint1(regions[0], MeshData::FID_MESH_IFACE_ELEMLID),
+         AffAccROPoint1(regions[0], MeshData::FID_MESH_IFACE_ELEMRID)},
+        {AffAccROPoint1(regions[1], MeshData::FID_MESH_IFACE_ELEMLID),
+         AffAccROPoint1(regions[1], MeshData::FID_MESH_IFACE_ELEMRID)}};
+    const AffAccROPoint1 acc_partid(regions[2], MeshData::FID_MESH_ELEM_PARTID);
+    Point<1> color = task->index_point;
+    PartitionCount count = {0, 0, 0};
+
+    Domain halo_domain = runtime->get_index_space_domain(ctx,
+        task->regions[2].region.get_index_space());
+    for (Domain::DomainPointIterator itr(halo_domain); itr; itr++) {
+        if (acc_partid[*itr] != color) count.nHalo++;
+    }
+
+    for (int lr=0; lr<2; lr++) {
+        Domain domain = runtime->get_index_space_domain(ctx,
+            task->regions[lr].region.get_index_space());
+        for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+            count.nItem++;
+            Point<1> elemL = acc_elem[lr][0][*itr];
+            Point<1> elemR = acc_elem[lr][1][*itr];
+            if (!halo_domain.contains(DomainPoint(elemL)) ||
+                !halo_domain.contains(DomainPoint(elemR))) {
+                count.nError++;
+                continue;
+            }
+            // the face must belong to the piece through its left (resp. right) element
+            if (acc_partid[lr==0 ? elemL : elemR] != color) count.nError++;
+        }
+    }
+    return count;
+}
+
+void MeshData::register_tasks() {
+    {
+        TaskVariantRegistrar registrar(INIT_MESH_ELEM_TASK_ID, "init_mesh_elem_task");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf();
+        Runtime::preregister_task_variant<init_mesh_elem_task> (registrar,
+            "init_mesh_elem_task");
+    }
+    {
+        TaskVariantRegistrar registrar(INIT_MESH_IFACE_TASK_ID, "init_mesh_iface_task");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf();
+        Runtime::preregister_task_variant<init_mesh_iface_task> (registrar,
+            "init_mesh_iface_task");
+    }
+    {
+        TaskVariantRegistrar registrar(INIT_MESH_BFACE_TASK_ID, "init_mesh_bface_task");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf();
+        Runtime::preregister_task_variant<init_mesh_bface_task> (registrar,
+            "init_mesh_bface_task");
+    }
+    {
+        TaskVariantRegistrar registrar(INIT_MESH_NODE_RANGE_TASK_ID, "init_mesh_node_range_task");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf();
+        Runtime::preregister_task_variant<init_mesh_node_range_task> (registrar,
+            "init_mesh_node_range_task");
+    }
+    {
+        TaskVariantRegistrar registrar(CHECK_ELEM_PARTITION_TASK_ID, "check_elem_partition_task");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf();
+        Runtime::preregister_task_variant<PartitionCount, check_elem_partition_task> (registrar,
+            "check_elem_partition_task");
+    }
+    {
+        TaskVariantRegistrar registrar(CHECK_HALO_PARTITION_TASK_ID, "check_halo_partition_task");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf();
+        Runtime::preregister_task_variant<PartitionCount, check_halo_partition_task> (registrar,
+            "check_halo_partition_task");
+    }
+}
+
 MeshData::MeshData(Context ctx, HighLevelRuntime *runtime, Legion::Logger &logger) :
-    LegionData(ctx, runtime, logger), nPart(-1) {}
+    LegionData(ctx, runtime, logger), nPart(-1), nBFG(0), nBFace(0) {}
+
+MeshData::~MeshData() {
+    clean_up();
+}
 
 void MeshData::clean_up() {
-    runtime->destroy_index_partition(ctx, elem_lp.get_index_partition());
-    runtime->destroy_index_partition(ctx, elem_with_halo_lp.get_index_partition());
-    runtime->destroy_index_partition(ctx, iface_lp.get_index_partition());
-    runtime->destroy_index_partition(ctx, iface_all_lp.get_index_partition());
+    // logical partitions are only names for the index partitions and need no deletion
+    elem_ip.reset();
+    elem_with_halo_ip.reset();
+    iface_ip.reset();
+    iface_R_ip.reset();
+    iface_all_ip.reset();
+    // the per-group partitions live below the group partition and go first
+    bface_ip.clear();
+    bface_lp.clear();
+    bface_group_ip.reset();
+    nBFG = nBFace = 0;
 
-    runtime->destroy_logical_partition(ctx, elem_lp);
-    runtime->destroy_logical_partition(ctx, elem_with_halo_lp);
-    runtime->destroy_logical_partition(ctx, iface_lp);
-    runtime->destroy_logical_partition(ctx, iface_all_lp);
+    elem_lr.reset();
+    iface_lr.reset();
+    bface_lr.reset();
 
-    runtime->destroy_field_space(ctx, elem_lr.get_field_space());
-    runtime->destroy_field_space(ctx, iface_lr.get_field_space());
+    elem_fs.reset();
+    iface_fs.reset();
+    bface_fs.reset();
 
-    runtime->destroy_index_space(ctx, elem_lr.get_index_space());
-    runtime->destroy_index_space(ctx, iface_lr.get_index_space());
+    elem_is.reset();
+    iface_is.reset();
+    bface_is.reset();
+    part_is.reset();
+    bfg_is.reset();
+}
 
-    runtime->destroy_logical_region(ctx, elem_lr);
-    runtime->destroy_logical_region(ctx, iface_lr);
+Future MeshData::stage_array(const void *data, LogicalRegion lr, LogicalPartition lp,
+                             const FieldID fid) {
+    LegionHandle<LogicalRegion> ext_lr(ctx, runtime,
+        runtime->create_logical_region(ctx, lr.get_index_space(), lr.get_field_space()));
+    runtime->attach_name(ext_lr.get(), "mesh_init_external_logical_region");
+    LogicalPartition ext_lp = runtime->get_logical_partition(ctx, ext_lr, lp.get_index_partition());
+
+    // the array is only read through the attached instance
+    AttachLauncher attach_launcher(EXTERNAL_INSTANCE, ext_lr, ext_lr);
+    attach_launcher.attach_array_soa(const_cast<void *>(data), false, vector<FieldID>(1, fid));
+    PhysicalRegion ext_pr = runtime->attach_external_resource(ctx, attach_launcher);
+
+    IndexCopyLauncher copy_launcher(runtime->get_index_space_domain(ctx, init_is));
+    RegionRequirement src_req(ext_lp, 0, READ_ONLY, EXCLUSIVE, ext_lr);
+    src_req.add_field(fid);
+    RegionRequirement dst_req(lp, 0, WRITE_DISCARD, EXCLUSIVE, lr);
+    dst_req.add_field(fid);
+    copy_launcher.add_copy_requirements(src_req, dst_req);
+    runtime->issue_copy_operation(ctx, copy_launcher);
+
+    return runtime->detach_external_resource(ctx, ext_pr, false);
+    // ext_lr goes out of scope here, its deletion is deferred until the detach is done
 }
 
 void MeshData::init_mesh_region_elem(const Mesh &mesh) {
@@ -42,38 +270,101 @@ void MeshData::init_mesh_region_elem(const Mesh &mesh) {
     Rect<1> rect(0, nElem - 1);
     IndexSpace is = runtime->create_index_space(ctx, rect);
     runtime->attach_name(is, "mesh_elem_index_space");
+    elem_is.reset(ctx, runtime, is);
 
     // create field space and allocate
     FieldSpace fs = runtime->create_field_space(ctx);
     runtime->attach_name(fs, "mesh_elem_field_space");
+    elem_fs.reset(ctx, runtime, fs);
     FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
 
     allocator.allocate_field(sizeof(Point<1>), FID_MESH_ELEM_PARTID);
+    allocator.allocate_field(nNode_per_elem*dim*sizeof(rtype), FID_MESH_ELEM_NODE_COORDS);
     runtime->attach_name(fs, FID_MESH_ELEM_PARTID, "mesh_elem_partition_id");
+    runtime->attach_name(fs, FID_MESH_ELEM_NODE_COORDS, "mesh_elem_node_coordinates");
+    // initialization fields, eind holds nNode_per_elem nodes per element in order
+    allocator.allocate_field(sizeof(idx_t), FID_INIT_ELEM_PARTID);
+    allocator.allocate_field(nNode_per_elem*sizeof(idx_t), FID_INIT_ELEM_NODES);
+    allocator.allocate_field(sizeof(Rect<1>), FID_INIT_ELEM_NODE_RANGE);
 
     // create logical region
-    elem_lr = runtime->create_logical_region(ctx, is, fs);
-    runtime->attach_name(elem_lr, "mesh_elem_logical_region");
+    elem_lr.reset(ctx, runtime, runtime->create_logical_region(ctx, is, fs));
+    runtime->attach_name(elem_lr.get(), "mesh_elem_logical_region");
 
-    // define region requirement that determines what to map as well as privileges
-    RegionRequirement req(elem_lr, WRITE_DISCARD, EXCLUSIVE, elem_lr);
-    req.add_field(FID_MESH_ELEM_PARTID);
+    // every point of the launches initializes one piece of an equal partition
+    LegionHandle<IndexPartition> init_ip(ctx, runtime,
+        runtime->create_equal_partition(ctx, is, init_is));
+    runtime->attach_name(init_ip.get(), "mesh_elem_init_index_partition");
+    LogicalPartition init_lp = runtime->get_logical_partition(ctx, elem_lr, init_ip);
+    Domain init_domain = runtime->get_index_space_domain(ctx, init_is);
 
-    InlineLauncher inline_launcher(req);
-    PhysicalRegion pr = runtime->map_region(ctx, inline_launcher);
-    pr.wait_until_valid();
+    // node coordinates in a temporary node region, equally partitioned for the copy
+    vector<rtype> coord((size_t) mesh.nNode*dim);
+    for (int inode=0; inode<mesh.nNode; inode++) {
+        memcpy(&coord[(size_t) inode*dim], mesh.coord[inode].data(), dim*sizeof(rtype));
+    }
+    LegionHandle<IndexSpace> node_is(ctx, runtime,
+        runtime->create_index_space(ctx, Rect<1>(0, mesh.nNode - 1)));
+    runtime->attach_name(node_is.get(), "mesh_node_index_space");
+    LegionHandle<FieldSpace> node_fs(ctx, runtime, runtime->create_field_space(ctx));
+    runtime->attach_name(node_fs.get(), "mesh_node_field_space");
+    FieldAllocator node_allocator = runtime->create_field_allocator(ctx, node_fs);
+    node_allocator.allocate_field(dim*sizeof(rtype), FID_INIT_NODE_COORDS);
+    LegionHandle<LogicalRegion> node_lr(ctx, runtime,
+        runtime->create_logical_region(ctx, node_is, node_fs));
+    runtime->attach_name(node_lr.get(), "mesh_node_logical_region");
+    LegionHandle<IndexPartition> node_init_ip(ctx, runtime,
+        runtime->create_equal_partition(ctx, node_is, init_is));
+    LogicalPartition node_init_lp = runtime->get_logical_partition(ctx, node_lr, node_init_ip);
 
-    const AccWDPoint1 acc_partid(pr, FID_MESH_ELEM_PARTID);
+    vector<Future> detached;
+    detached.push_back(stage_array(mesh.elem_part_id.data(), elem_lr, init_lp,
+        FID_INIT_ELEM_PARTID));
+    detached.push_back(stage_array(mesh.eind.data(), elem_lr, init_lp, FID_INIT_ELEM_NODES));
+    detached.push_back(stage_array(coord.data(), node_lr, node_init_lp, FID_INIT_NODE_COORDS));
 
-    // initialize
-    int ielem = 0;
-    // loop over elements
-    for (PointInRectIterator<1> pir(rect); pir(); pir++) {
-        acc_partid[*pir] = mesh.elem_part_id[ielem];
-        ielem += 1;
+    // range of the node IDs of each element, its image gives the nodes read by each piece
+    MeshInitArgs args;
+    args.nNode_per_elem = nNode_per_elem;
+    args.dim = dim;
+    {
+        IndexLauncher index_launcher(INIT_MESH_NODE_RANGE_TASK_ID, init_domain,
+            TaskArgument(&args, sizeof(MeshInitArgs)), ArgumentMap());
+        RegionRequirement req(init_lp, 0, READ_ONLY, EXCLUSIVE, elem_lr);
+        req.add_field(FID_INIT_ELEM_NODES);
+        index_launcher.add_region_requirement(req);
+        req = RegionRequirement(init_lp, 0, WRITE_DISCARD, EXCLUSIVE, elem_lr);
+        req.add_field(FID_INIT_ELEM_NODE_RANGE);
+        index_launcher.add_region_requirement(req);
+        runtime->execute_index_space(ctx, index_launcher);
     }
+    LegionHandle<IndexPartition> node_ip(ctx, runtime,
+        runtime->create_partition_by_image_range(ctx, node_is, init_lp, elem_lr,
+            FID_INIT_ELEM_NODE_RANGE, init_is));
+    runtime->attach_name(node_ip.get(), "mesh_node_init_index_partition");
+    LogicalPartition node_lp = runtime->get_logical_partition(ctx, node_lr, node_ip);
+
+    IndexLauncher index_launcher(INIT_MESH_ELEM_TASK_ID, init_domain,
+        TaskArgument(&args, sizeof(MeshInitArgs)), ArgumentMap());
+    RegionRequirement req(init_lp, 0, WRITE_DISCARD, EXCLUSIVE, elem_lr);
+    req.add_field(FID_MESH_ELEM_PARTID);
+    req.add_field(FID_MESH_ELEM_NODE_COORDS);
+    index_launcher.add_region_requirement(req);
+    req = RegionRequirement(init_lp, 0, READ_ONLY, EXCLUSIVE, elem_lr);
+    req.add_field(FID_INIT_ELEM_PARTID);
+    req.add_field(FID_INIT_ELEM_NODES);
+    index_launcher.add_region_requirement(req);
+    req = RegionRequirement(node_lp, 0, READ_ONLY, EXCLUSIVE, node_lr);
+    req.add_field(FID_INIT_NODE_COORDS);
+    index_launcher.add_region_requirement(req);
+    runtime->execute_index_space(ctx, index_launcher);
 
-    runtime->unmap_region(ctx, pr);
+    allocator.free_field(FID_INIT_ELEM_PARTID);
+    allocator.free_field(FID_INIT_ELEM_NODES);
+    allocator.free_field(FID_INIT_ELEM_NODE_RANGE);
+    // the attached arrays must outlive the copies, the temporary handles are released on return
+    // and their deletion is deferred until the initialization is done
+    for (auto &f: detached) f.get_void_result();
 }
 
 void MeshData::init_mesh_region_iFace(const Mesh &mesh) {
@@ -82,50 +373,130 @@ void MeshData::init_mesh_region_iFace(const Mesh &mesh) {
     Rect<1> rect(0, nIFace-1);
     IndexSpace is = runtime->create_index_space(ctx, rect);
     runtime->attach_name(is, "mesh_iFace_index_space");
+    iface_is.reset(ctx, runtime, is);
 
     // create field space and allocate
     FieldSpace fs = runtime->create_field_space(ctx);
     runtime->attach_name(fs, "mesh_data_field_space");
+    iface_fs.reset(ctx, runtime, fs);
     FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
     allocator.allocate_field(sizeof(Point<1>), FID_MESH_IFACE_ELEMLID);
     allocator.allocate_field(sizeof(Point<1>), FID_MESH_IFACE_ELEMRID);
+    allocator.allocate_field(sizeof(int), FID_MESH_IFACE_FACEL);
+    allocator.allocate_field(sizeof(int), FID_MESH_IFACE_FACER);
+    allocator.allocate_field(6*sizeof(int), FID_INIT_IFACE_DATA);
 
     runtime->attach_name(fs, FID_MESH_IFACE_ELEMLID, "mesh_iface_left_element_id");
     runtime->attach_name(fs, FID_MESH_IFACE_ELEMRID, "mesh_iface_right_element_ID");
+    runtime->attach_name(fs, FID_MESH_IFACE_FACEL, "mesh_iface_left_face_id");
+    runtime->attach_name(fs, FID_MESH_IFACE_FACER, "mesh_iface_right_face_id");
 
     // create logical region
-    iface_lr = runtime->create_logical_region(ctx, is, fs);
-    runtime->attach_name(iface_lr, "mesh_iface_logical_region");
+    iface_lr.reset(ctx, runtime, runtime->create_logical_region(ctx, is, fs));
+    runtime->attach_name(iface_lr.get(), "mesh_iface_logical_region");
 
-    // define region requirement that determines what to map as well as privileges
-    RegionRequirement req(iface_lr, WRITE_DISCARD, EXCLUSIVE, iface_lr);
+    // every point of the launch initializes one piece of an equal partition
+    LegionHandle<IndexPartition> init_ip(ctx, runtime,
+        runtime->create_equal_partition(ctx, is, init_is));
+    runtime->attach_name(init_ip.get(), "mesh_iface_init_index_partition");
+    LogicalPartition init_lp = runtime->get_logical_partition(ctx, iface_lr, init_ip);
+
+    vector<int> face_data((size_t) 6*nIFace);
+    for (int iface=0; iface<nIFace; iface++) {
+        memcpy(&face_data[(size_t) 6*iface], mesh.IFace_to_elem[iface].data(), 6*sizeof(int));
+    }
+    Future detached = stage_array(face_data.data(), iface_lr, init_lp, FID_INIT_IFACE_DATA);
+
+    IndexLauncher index_launcher(INIT_MESH_IFACE_TASK_ID,
+        runtime->get_index_space_domain(ctx, init_is), TaskArgument(), ArgumentMap());
+    RegionRequirement req(init_lp, 0, WRITE_DISCARD, EXCLUSIVE, iface_lr);
     req.add_field(FID_MESH_IFACE_ELEMLID);
     req.add_field(FID_MESH_IFACE_ELEMRID);
+    req.add_field(FID_MESH_IFACE_FACEL);
+    req.add_field(FID_MESH_IFACE_FACER);
+    index_launcher.add_region_requirement(req);
+    req = RegionRequirement(init_lp, 0, READ_ONLY, EXCLUSIVE, iface_lr);
+    req.add_field(FID_INIT_IFACE_DATA);
+    index_launcher.add_region_requirement(req);
+    runtime->execute_index_space(ctx, index_launcher);
+
+    allocator.free_field(FID_INIT_IFACE_DATA);
+    detached.get_void_result();
+    // init_ip goes out of scope here, its deletion is deferred until the initialization is done
+}
+
+void MeshData::init_mesh_region_bFace(const Mesh &mesh) {
+    // boundary faces are numbered group after group, in the order of the group names
+    nBFG = mesh.nBFG;
+    nBFace = mesh.nBFace;
+    bfg_names = mesh.BFG_names;
+    IndexSpace is = runtime->create_index_space(ctx, Rect<1>(0, nBFace-1));
+    runtime->attach_name(is, "mesh_bFace_index_space");
+    bface_is.reset(ctx, runtime, is);
 
-    InlineLauncher inline_launcher(req);
-    PhysicalRegion pr = runtime->map_region(ctx, inline_launcher);
-    pr.wait_until_valid();
+    FieldSpace fs = runtime->create_field_space(ctx);
+    runtime->attach_name(fs, "mesh_bface_field_space");
+    bface_fs.reset(ctx, runtime, fs);
+    FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
+    allocator.allocate_field(sizeof(Point<1>), FID_MESH_BFACE_ELEMID);
+    allocator.allocate_field(sizeof(int), FID_MESH_BFACE_FACE);
+    allocator.allocate_field(sizeof(Point<1>), FID_MESH_BFACE_GROUP);
+    allocator.allocate_field(3*sizeof(int), FID_INIT_BFACE_DATA);
+
+    runtime->attach_name(fs, FID_MESH_BFACE_ELEMID, "mesh_bface_element_id");
+    runtime->attach_name(fs, FID_MESH_BFACE_FACE, "mesh_bface_face_id");
+    runtime->attach_name(fs, FID_MESH_BFACE_GROUP, "mesh_bface_group_id");
 
-    // accessors
-    AccWDPoint1  acc_point[2];
-    acc_point[0] = AccWDPoint1(pr, FID_MESH_IFACE_ELEMLID);
-    acc_point[1] = AccWDPoint1(pr, FID_MESH_IFACE_ELEMRID);
+    bface_lr.reset(ctx, runtime, runtime->create_logical_region(ctx, is, fs));
+    runtime->attach_name(bface_lr.get(), "mesh_bface_logical_region");
 
-    // initialize
-    int iface = 0;
-    // loop over elements
-    for (PointInRectIterator<1> pir(rect); pir(); pir++, iface++) {
-        // left and right elements ID as Point<1>
-        acc_point[0][*pir] = mesh.IFace_to_elem[iface][0];
-        acc_point[1][*pir] = mesh.IFace_to_elem[iface][3];
+    vector<int> bface_data;
+    bface_data.reserve(3*nBFace);
+    for (int igroup=0; igroup<nBFG; igroup++) {
+        for (auto &face: mesh.BFG_to_data.at(bfg_names[igroup])) {
+            bface_data.push_back(face[0]);
+            bface_data.push_back(face[1]);
+            bface_data.push_back(igroup);
+        }
     }
 
-    runtime->unmap_region(ctx, pr);
+    LegionHandle<IndexPartition> init_ip(ctx, runtime,
+        runtime->create_equal_partition(ctx, is, init_is));
+    runtime->attach_name(init_ip.get(), "mesh_bface_init_index_partition");
+    LogicalPartition init_lp = runtime->get_logical_partition(ctx, bface_lr, init_ip);
+    Future detached = stage_array(bface_data.data(), bface_lr, init_lp, FID_INIT_BFACE_DATA);
+
+    IndexLauncher index_launcher(INIT_MESH_BFACE_TASK_ID,
+        runtime->get_index_space_domain(ctx, init_is), TaskArgument(), ArgumentMap());
+    RegionRequirement req(init_lp, 0, WRITE_DISCARD, EXCLUSIVE, bface_lr);
+    req.add_field(FID_MESH_BFACE_ELEMID);
+    req.add_field(FID_MESH_BFACE_FACE);
+    req.add_field(FID_MESH_BFACE_GROUP);
+    index_launcher.add_region_requirement(req);
+    req = RegionRequirement(init_lp, 0, READ_ONLY, EXCLUSIVE, bface_lr);
+    req.add_field(FID_INIT_BFACE_DATA);
+    index_launcher.add_region_requirement(req);
+    runtime->execute_index_space(ctx, index_launcher);
+
+    allocator.free_field(FID_INIT_BFACE_DATA);
+    detached.get_void_result();
 }
 
 void MeshData::init_mesh_region(const Mesh &mesh) {
+    nNode_per_elem = mesh.nNode_per_elem;
+    dim = mesh.dim;
+    order = mesh.order;
+
+    // color space of the equal partitions used to initialize the regions in parallel
+    init_is.reset(ctx, runtime, runtime->create_index_space(ctx, Rect<1>(0, mesh.nPart-1)));
+    runtime->attach_name(init_is.get(), "mesh_init_index_space");
     init_mesh_region_elem(mesh);
     init_mesh_region_iFace(mesh);
+    // without boundary faces there is no group to partition or launch over, even if the mesh
+    // names some
+    if (mesh.nBFace > 0) init_mesh_region_bFace(mesh);
+    else nBFG = nBFace = 0;
+    init_is.reset();
     runtime->print_once(ctx, stdout, "Mesh region successfully initialized\n");
 }
 
@@ -133,41 +504,131 @@ void MeshData::partition_mesh_region(const int nPart_) {
     nPart = nPart_;
 
     // partition elements
-    IndexSpace part_is = runtime->create_index_space(ctx, Rect<1>(0, nPart-1));
-    runtime->attach_name(part_is, "partition_index_space");
-    IndexPartition elem_ip = runtime->create_partition_by_field(ctx,
-        elem_lr, elem_lr, FID_MESH_ELEM_PARTID, part_is);
-    runtime->attach_name(elem_ip, "element_index_partition");
+    part_is.reset(ctx, runtime, runtime->create_index_space(ctx, Rect<1>(0, nPart-1)));
+    runtime->attach_name(part_is.get(), "partition_index_space");
+    elem_ip.reset(ctx, runtime, runtime->create_partition_by_field(ctx,
+        elem_lr, elem_lr, FID_MESH_ELEM_PARTID, part_is));
+    runtime->attach_name(elem_ip.get(), "element_index_partition");
     elem_lp = runtime->get_logical_partition(ctx, elem_lr, elem_ip);
     runtime->attach_name(elem_lp, "element_logical_partition");
     domain = Domain::from_rect<1>(Arrays::Rect<1>(Arrays::Point<1>(0),
         Arrays::Point<1>(nPart-1)));
 
-    // partition ifaces
-    IndexPartition iface_ipL = runtime->create_partition_by_preimage(ctx, elem_ip,
-        iface_lr, iface_lr, FID_MESH_IFACE_ELEMLID, part_is);
-    runtime->attach_name(iface_ipL, "left internal face index partition");
-    IndexPartition iface_ipR = runtime->create_partition_by_preimage(ctx, elem_ip,
-        iface_lr, iface_lr, FID_MESH_IFACE_ELEMRID, part_is);
-    runtime->attach_name(iface_ipR, "right_internal_face_index_partition");
-    IndexPartition iface_ip = runtime->create_partition_by_union(ctx, iface_lr.get_index_space(),
-        iface_ipL, iface_ipR, part_is);
-    runtime->attach_name(iface_ip, "all_internal_face_index_partition");
-    iface_lp = runtime->get_logical_partition(ctx, iface_lr, iface_ipL);
+    // partition ifaces by left and by right element, the union gives all faces touching a partition
+    iface_ip.reset(ctx, runtime, runtime->create_partition_by_preimage(ctx, elem_ip,
+        iface_lr, iface_lr, FID_MESH_IFACE_ELEMLID, part_is));
+    runtime->attach_name(iface_ip.get(), "left internal face index partition");
+    iface_R_ip.reset(ctx, runtime, runtime->create_partition_by_preimage(ctx, elem_ip,
+        iface_lr, iface_lr, FID_MESH_IFACE_ELEMRID, part_is));
+    runtime->attach_name(iface_R_ip.get(), "right_internal_face_index_partition");
+    iface_all_ip.reset(ctx, runtime, runtime->create_partition_by_union(ctx,
+        iface_lr->get_index_space(), iface_ip, iface_R_ip, part_is));
+    runtime->attach_name(iface_all_ip.get(), "all_internal_face_index_partition");
+    iface_lp = runtime->get_logical_partition(ctx, iface_lr, iface_ip);
     runtime->attach_name(iface_lp, "internal_face_logical_partition");
-    iface_all_lp = runtime->get_logical_partition(ctx, iface_lr, iface_ip);
+    iface_R_lp = runtime->get_logical_partition(ctx, iface_lr, iface_R_ip);
+    runtime->attach_name(iface_R_lp, "right_internal_face_logical_partition");
+    iface_all_lp = runtime->get_logical_partition(ctx, iface_lr, iface_all_ip);
     runtime->attach_name(iface_all_lp, "all_internal_face_logical_partition");
 
-    // partition element with halo
-    IndexPartition ip1 = runtime->create_partition_by_image(ctx, elem_lr.get_index_space(),
-        iface_all_lp, iface_lr, FID_MESH_IFACE_ELEMLID, part_is);
-    runtime->attach_name(ip1, "temporary_index_partition_for_left_elements");
-    IndexPartition ip2 = runtime->create_partition_by_image(ctx, elem_lr.get_index_space(),
-        iface_all_lp, iface_lr, FID_MESH_IFACE_ELEMRID, part_is);
-    runtime->attach_name(ip2, "temporary_index_partition_for_right_elements");
-    IndexPartition ip = runtime->create_partition_by_union(ctx, elem_lr.get_index_space(),
-        ip1, ip2, part_is);
-    runtime->attach_name(ip, "index_partition_for_elements_with_halo");
-    elem_with_halo_lp = runtime->get_logical_partition(ctx, elem_lr, ip);
+    // partition element with halo, the images are temporaries released once the union exists
+    LegionHandle<IndexPartition> ip1(ctx, runtime,
+        runtime->create_partition_by_image(ctx, elem_lr->get_index_space(),
+            iface_all_lp, iface_lr, FID_MESH_IFACE_ELEMLID, part_is));
+    runtime->attach_name(ip1.get(), "temporary_index_partition_for_left_elements");
+    LegionHandle<IndexPartition> ip2(ctx, runtime,
+        runtime->create_partition_by_image(ctx, elem_lr->get_index_space(),
+            iface_all_lp, iface_lr, FID_MESH_IFACE_ELEMRID, part_is));
+    runtime->attach_name(ip2.get(), "temporary_index_partition_for_right_elements");
+    elem_with_halo_ip.reset(ctx, runtime, runtime->create_partition_by_union(ctx,
+        elem_lr->get_index_space(), ip1, ip2, part_is));
+    runtime->attach_name(elem_with_halo_ip.get(), "index_partition_for_elements_with_halo");
+    ip1.reset();
+    ip2.reset();
+    elem_with_halo_lp = runtime->get_logical_partition(ctx, elem_lr, elem_with_halo_ip);
     runtime->attach_name(elem_with_halo_lp, "element_with_halo_logical_partition");
+
+    // partition boundary faces by group, then each group by the partition of its elements (every
+    // group gets one, empty groups included); without boundary faces nBFG is 0 and none is needed
+    if (nBFace == 0) return;
+    bfg_is.reset(ctx, runtime, runtime->create_index_space(ctx, Rect<1>(0, nBFG-1)));
+    runtime->attach_name(bfg_is.get(), "boundary_face_group_index_space");
+    bface_group_ip.reset(ctx, runtime, runtime->create_partition_by_field(ctx,
+        bface_lr, bface_lr, FID_MESH_BFACE_GROUP, bfg_is));
+    runtime->attach_name(bface_group_ip.get(), "boundary_face_group_index_partition");
+    bface_group_lp = runtime->get_logical_partition(ctx, bface_lr, bface_group_ip);
+    for (int igroup=0; igroup<nBFG; igroup++) {
+        LogicalRegion group_lr = runtime->get_logical_subregion_by_color(ctx, bface_group_lp,
+            igroup);
+        bface_ip.push_back(LegionHandle<IndexPartition>(ctx, runtime,
+            runtime->create_partition_by_preimage(ctx, elem_ip, group_lr, bface_lr,
+                FID_MESH_BFACE_ELEMID, part_is)));
+        bface_lp.push_back(runtime->get_logical_partition(ctx, group_lr, bface_ip.back()));
+        runtime->attach_name(bface_lp.back(), ("boundary_face_logical_partition_" +
+            bfg_names[igroup]).c_str());
+    }
+}
+
+int MeshData::check_initial_partitioning() {
+    IndexLauncher index_launcher(CHECK_ELEM_PARTITION_TASK_ID, domain, TaskArgument(),
+        ArgumentMap());
+    RegionRequirement req(elem_lp, 0, READ_ONLY, EXCLUSIVE, elem_lr);
+    req.add_field(FID_MESH_ELEM_PARTID);
+    index_launcher.add_region_requirement(req);
+    FutureMap counts = runtime->execute_index_space(ctx, index_launcher);
+
+    int nItem = 0, nError = 0;
+    for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+        PartitionCount count = counts.get_result<PartitionCount>(itr.p);
+        nItem += count.nItem;
+        nError += count.nError;
+    }
+    // every element belongs to its own piece only, so the pieces are disjoint, and they are
+    // complete when they hold all the elements
+    if (nItem != nElem) nError += abs(nElem - nItem);
+
+    char msg[200];
+    sprintf(msg, "Element partition: %d elements in %d pieces, %d errors\n", nItem, nPart,
+        nError);
+    runtime->print_once(ctx, stdout, msg);
+    return nError;
+}
+
+int MeshData::check_partitioning_with_halo() {
+    IndexLauncher index_launcher(CHECK_HALO_PARTITION_TASK_ID, domain, TaskArgument(),
+        ArgumentMap());
+    RegionRequirement req(iface_lp, 0, READ_ONLY, EXCLUSIVE, iface_lr);
+    req.add_field(FID_MESH_IFACE_ELEMLID);
+    req.add_field(FID_MESH_IFACE_ELEMRID);
+    index_launcher.add_region_requirement(req);
+    req = RegionRequirement(iface_R_lp, 0, READ_ONLY, EXCLUSIVE, iface_lr);
+    req.add_field(FID_MESH_IFACE_ELEMLID);
+    req.add_field(FID_MESH_IFACE_ELEMRID);
+    index_launcher.add_region_requirement(req);
+    req = RegionRequirement(elem_with_halo_lp, 0, READ_ONLY, EXCLUSIVE, elem_lr);
+    req.add_field(FID_MESH_ELEM_PARTID);
+    index_launcher.add_region_requirement(req);
+    FutureMap counts = runtime->execute_index_space(ctx, index_launcher);
+
+    int nItem = 0, nHalo = 0, nError = 0;
+    for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+        PartitionCount count = counts.get_result<PartitionCount>(itr.p);
+        nItem += count.nItem;
+        nHalo += count.nHalo;
+        nError += count.nError;
+    }
+
+    char msg[200];
+    sprintf(msg, "Halo partition: %d face visits, %d halo elements, %d errors\n", nItem, nHalo,
+        nError);
+    runtime->print_once(ctx, stdout, msg);
+    return nError;
+}
+
+void MeshData::check_partitioning() {
+    int nError = check_initial_partitioning() + check_partitioning_with_halo();
+    if (nError > 0) {
+        runtime->print_once(ctx, stderr, "Inconsistent mesh partitioning\n");
+        exit(EXIT_FAILURE);
+    }
 }
@@ -5,9 +5,29 @@
 #ifndef DG_MESH_DATA_H
 #define DG_MESH_DATA_H
 
+#include <string>
+#include <vector>
 #include "legion.h"
+#include "legion_handle.h"
 #include "mesh.h"
 
+/*! \brief Arguments of the mesh initialization tasks
+ *
+ */
+struct MeshInitArgs {
+    int nNode_per_elem; //!< number of nodes per element
+    int dim; //!< number of spatial dimensions
+};
+
+/*! \brief Result of a partition check task for one partition
+ *
+ */
+struct PartitionCount {
+    int nItem; //!< number of items checked
+    int nHalo; //!< number of halo elements (halo check only)
+    int nError; //!< number of items failing the check
+};
+
 class LegionData {
 public:
     /*! \brief Constructor
@@ -36,8 +56,33 @@ class MeshData : public LegionData {
         FID_MESH_ELEM_PARTID, //!< element partition ID
         FID_MESH_IFACE_ELEMLID, //!< interior face's left element
         FID_MESH_IFACE_ELEMRID, //!< interior face's right element
+        FID_MESH_ELEM_NODE_COORDS, //!< coordinates of the element nodes (node after node)
+        FID_MESH_IFACE_FACEL, //!< interior face's ID from the point of view of the left element
+        FID_MESH_IFACE_FACER, //!< interior face's ID from the point of view of the right element
+        FID_MESH_BFACE_ELEMID, //!< boundary face's element
+        FID_MESH_BFACE_FACE, //!< boundary face's ID from the point of view of the element
+        FID_MESH_BFACE_GROUP, //!< boundary face's group, in the order of Mesh::BFG_names
     };
 
+    /*! \brief Fields holding the mesh object's arrays during the initialization
+     *
+     * They are allocated next to the mesh fields and freed once the regions are initialized, the
+     * node coordinates live in a temporary node region.
+     */
+    enum InitFieldIDs {
+        FID_INIT_ELEM_PARTID = 50, //!< element partition ID from metis (idx_t)
+        FID_INIT_ELEM_NODES, //!< element node IDs (nNode_per_elem idx_t)
+        FID_INIT_ELEM_NODE_RANGE, //!< range of the element node IDs
+        FID_INIT_NODE_COORDS, //!< node coordinates
+        FID_INIT_IFACE_DATA, //!< row of Mesh::IFace_to_elem (6 int)
+        FID_INIT_BFACE_DATA, //!< boundary face's element, face and group (3 int)
+    };
+
+    /*! \brief Pre-register all mesh related tasks
+     *
+     */
+    static void register_tasks();
+
     /*! \brief Constructor
      *
      * @param ctx Legion's context
@@ -46,15 +91,27 @@ class MeshData : public LegionData {
      */
     MeshData(Legion::Context ctx, Legion::HighLevelRuntime *runtime, Legion::Logger &logger);
 
+    /*! \brief Destructor
+     *
+     * Release the Legion ressources that are still owned.
+     */
+    ~MeshData();
+
     /*! \brief Clean up Legion's ressources used for mesh related regions
      *
+     * Called by the destructor as well. Calling it explicitly releases the ressources earlier.
      */
     void clean_up();
 
     /*! \brief Initialize the mesh regions
      *
      * Create mesh regions from the mesh object. This object is not needed anymore after these
-     * regions have been initialized.
+     * regions have been initialized. The arrays of the mesh object are attached to temporary
+     * regions and moved piece by piece by index copies over an equal partition with as many pieces
+     * as mesh partitions, so that each point of the initialization launches reads its own slice
+     * from a local instance. Only arrays of vectors are flattened by the calling task, the control
+     * task never builds per-piece slices nor serializes the mesh into task arguments. Blocks until
+     * the mesh object is not read anymore.
      *
      * @param mesh mesh object
      */
@@ -62,7 +119,8 @@ class MeshData : public LegionData {
 
     /*! Partition the mesh regions
      *
-     * Generate 2 partitions for the elements (one without and with halo elements).
+     * Generate 2 partitions for the elements (one without and with halo elements). Boundary faces
+     * are first split by group, then each group is partitioned like its elements.
      *
      * @param nPart number of partitions
      */
@@ -70,19 +128,33 @@ class MeshData : public LegionData {
 
     /*! Check partitioning
      *
-     * Print the partition data. Only used for verification purposes. Use it on a small mesh and in
-     * serial.
+     * Verify the element partitions with one index launch per check, each partition checking its
+     * own pieces in parallel, and print the counts. Exits if a check fails. Cheap enough
+     * to be left on in production runs, it only blocks on the per-partition counts.
      */
     void check_partitioning();
 
     int nElem; //!< number of elements
     int nPart; //!< number of partitions
-    Legion::LogicalRegion elem_lr; //!< element logical region
+    int nNode_per_elem; //!< number of nodes per element
+    int dim; //!< number of spatial dimensions
+    int order; //!< geometric order
+    LegionHandle<Legion::LogicalRegion> elem_lr; //!< element logical region
     Legion::LogicalPartition elem_lp; //!< element logical partition without halo elements
     Legion::LogicalPartition elem_with_halo_lp; //!< element logical partition with halo elements
-    Legion::LogicalRegion iface_lr; //!< interior face logical region
-    Legion::LogicalPartition iface_lp; //!< interior face logical partition
+    LegionHandle<Legion::LogicalRegion> iface_lr; //!< interior face logical region
+    Legion::LogicalPartition iface_lp; //!< interior face logical partition (by left element)
+    Legion::LogicalPartition iface_R_lp; //!< interior face logical partition by right element
     Legion::LogicalPartition iface_all_lp; //!< all interior face logical partition
+    int nBFG; //!< number of boundary face groups
+    int nBFace; //!< number of boundary faces
+    std::vector<std::string> bfg_names; //!< boundary face group names
+    LegionHandle<Legion::LogicalRegion> bface_lr; //!< boundary face logical region
+    Legion::LogicalPartition bface_group_lp; //!< boundary face logical partition by group
+    /*! \brief Per group partition of the group's subregion, colored like elem_lp
+     *
+     */
+    std::vector<Legion::LogicalPartition> bface_lp;
 
   private:
     /*! \brief Initialize the mesh element region
@@ -97,19 +169,65 @@ class MeshData : public LegionData {
      */
     void init_mesh_region_iFace(const Mesh &mesh);
 
+    /*! \brief Initialize the mesh boundary face region
+     *
+     * @param mesh mesh object
+     */
+    void init_mesh_region_bFace(const Mesh &mesh);
+
+    /*! \brief Copy an array of the mesh object into a field of a region
+     *
+     * The array is attached to a temporary region with the same index and field spaces, which is
+     * copied into lp by an index copy and detached. The array must stay alive until the returned
+     * future is complete.
+     *
+     * @param data array, one value of the field size per point of the index space
+     * @param lr destination region
+     * @param lp destination partition, colored by init_is
+     * @param fid field ID
+     * @return future of the detach
+     */
+    Legion::Future stage_array(const void *data, Legion::LogicalRegion lr,
+                               Legion::LogicalPartition lp, const Legion::FieldID fid);
+
     /*! \brief Check the initial partitioning (the one without halo elements)
      *
-     * Print stuff. Only used for verification purposes. Use it on a small mesh and in serial.
+     * Each element of piece p must have the partition ID p and the pieces must hold nElem elements
+     * in total, which makes elem_lp disjoint and complete.
+     *
+     * @return number of errors
      */
-    void check_initial_partitioning();
+    int check_initial_partitioning();
 
     /*! \brief Check the partitioning containing halo
      *
-     * Print stuff. Only used for verification purposes. Use it on a small mesh and in serial.
+     * Both elements of every face touching piece p (iface_lp and iface_R_lp) must lie in piece p of
+     * elem_with_halo_lp, and every face of iface_lp must have its left element in partition p.
+     *
+     * @return number of errors
      */
-    void check_partitioning_with_halo();
+    int check_partitioning_with_halo();
 
     Legion::Domain domain; //!< domain associated with the partitioninig index space
+
+    // owners of the handles backing the regions and partitions above, partitions are declared last
+    // so that they are destroyed first
+    LegionHandle<Legion::IndexSpace> init_is; //!< color space of the initialization partitions
+    LegionHandle<Legion::IndexSpace> part_is; //!< color space of the mesh partitions
+    LegionHandle<Legion::IndexSpace> elem_is; //!< element index space
+    LegionHandle<Legion::IndexSpace> iface_is; //!< interior face index space
+    LegionHandle<Legion::IndexSpace> bface_is; //!< boundary face index space
+    LegionHandle<Legion::IndexSpace> bfg_is; //!< color space of the boundary face groups
+    LegionHandle<Legion::FieldSpace> elem_fs; //!< element field space
+    LegionHandle<Legion::FieldSpace> iface_fs; //!< interior face field space
+    LegionHandle<Legion::FieldSpace> bface_fs; //!< boundary face field space
+    LegionHandle<Legion::IndexPartition> elem_ip; //!< backs elem_lp
+    LegionHandle<Legion::IndexPartition> elem_with_halo_ip; //!< backs elem_with_halo_lp
+    LegionHandle<Legion::IndexPartition> iface_ip; //!< backs iface_lp
+    LegionHandle<Legion::IndexPartition> iface_R_ip; //!< backs iface_R_lp
+    LegionHandle<Legion::IndexPartition> iface_all_ip; //!< backs iface_all_lp
+    LegionHandle<Legion::IndexPartition> bface_group_ip; //!< backs bface_group_lp
+    std::vector<LegionHandle<Legion::IndexPartition>> bface_ip; //!< back bface_lp
 };
 
 
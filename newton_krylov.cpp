@@ -0,0 +1,340 @@
+//
+// Created by kihiro on 6/8/20.
+//
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <string>
+#include <vector>
+#include "legion.h"
+#include "newton_krylov.h"
+#include "ids.h"
+#include "redop.h"
+#include "typedefs.h"
+
+using namespace Legion;
+using namespace LegionRuntime;
+using namespace std;
+
+void linear_combination_task(const Task *task, const std::vector<PhysicalRegion> &regions,
+                             Context ctx, Runtime *runtime) {
+    LinCombArgs arg = *(const LinCombArgs *)task->args;
+    rtype a[3] = {arg.a[0], arg.a[1], arg.a[2]};
+    if (arg.future_mode == 1) a[0] *= task->futures[0].get_result<rtype>();
+    if (arg.future_mode == 2) {
+        rtype f = task->futures[0].get_result<rtype>();
+        a[1] /= f;
+        a[2] /= f;
+    }
+
+    const AffAccRWrtype acc_y(regions[0], arg.y, N_REDOP*sizeof(rtype));
+    // residual fields are stored as stype
+    bool residual[3];
+    AffAccROrtype acc_x[3];
+    AffAccROstype acc_xs[3];
+    for (int i=0; i<arg.nx; i++) {
+        residual[i] = SolutionData::is_residual_field(arg.x[i]);
+        if (residual[i]) acc_xs[i] = AffAccROstype(regions[1], arg.x[i], N_REDOP*sizeof(stype));
+        else acc_x[i] = AffAccROrtype(regions[1], arg.x[i], N_REDOP*sizeof(rtype));
+    }
+
+    Domain domain = runtime->get_index_space_domain(ctx, task->regions[0].region.get_index_space());
+    for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+        rtype *y = acc_y.ptr(itr.p);
+        // y may hold garbage when it is overwritten
+        for (int k=0; k<N_REDOP; k++) y[k] = arg.a0 == 0. ? 0. : arg.a0*y[k];
+        for (int i=0; i<arg.nx; i++) {
+            if (residual[i]) {
+                const stype *x = acc_xs[i].ptr(itr.p);
+                for (int k=0; k<N_REDOP; k++) y[k] += a[i]*x[k];
+            }
+            else {
+                const rtype *x = acc_x[i].ptr(itr.p);
+                for (int k=0; k<N_REDOP; k++) y[k] += a[i]*x[k];
+            }
+        }
+    }
+}
+
+rtype dot_task(const Task *task, const std::vector<PhysicalRegion> &regions,
+               Context ctx, Runtime *runtime) {
+    DotArgs arg = *(const DotArgs *)task->args;
+    const AffAccROrtype acc_x(regions[0], arg.x, N_REDOP*sizeof(rtype));
+    const AffAccROrtype acc_y(regions[0], arg.y, N_REDOP*sizeof(rtype));
+    Domain domain = runtime->get_index_space_domain(ctx, task->regions[0].region.get_index_space());
+    rtype result = 0.;
+    for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+        const rtype *x = acc_x.ptr(itr.p);
+        const rtype *y = acc_y.ptr(itr.p);
+        for (int k=0; k<N_REDOP; k++) result += x[k]*y[k];
+    }
+    return result;
+}
+
+rtype fd_step_task(const Task *task, const std::vector<PhysicalRegion> &regions,
+                   Context ctx, Runtime *runtime) {
+    FDStepArgs arg = *(const FDStepArgs *)task->args;
+    rtype u_norm = sqrt(task->futures[0].get_result<rtype>());
+    rtype v_norm = sqrt(task->futures[1].get_result<rtype>());
+    rtype h = arg.eps*(1. + u_norm);
+    return v_norm > 0. ? h/v_norm : h;
+}
+
+void NewtonKrylov::register_tasks() {
+    {
+        TaskVariantRegistrar registrar(LINEAR_COMBINATION_TASK_ID, "linear_combination_task");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf();
+        Runtime::preregister_task_variant<linear_combination_task> (registrar,
+            "linear_combination_task");
+    }
+    {
+        TaskVariantRegistrar registrar(DOT_TASK_ID, "dot_task");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf();
+        Runtime::preregister_task_variant<rtype, dot_task> (registrar, "dot_task");
+    }
+    {
+        TaskVariantRegistrar registrar(FD_STEP_TASK_ID, "fd_step_task");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf();
+        Runtime::preregister_task_variant<rtype, fd_step_task> (registrar, "fd_step_task");
+    }
+}
+
+NewtonKrylov::NewtonKrylov(Context ctx, HighLevelRuntime *runtime, Legion::Logger &logger,
+                           SolutionData &solution_data_, const rtype dt_, const int krylov_size_,
+                           const int newton_iterations_, const rtype newton_tolerance_,
+                           const rtype gmres_tolerance_, const rtype eps_) :
+    LegionData(ctx, runtime, logger), dt(dt_), time(0.), solution_data(solution_data_),
+    krylov_size(krylov_size_), newton_iterations(newton_iterations_),
+    newton_tolerance(newton_tolerance_), gmres_tolerance(gmres_tolerance_), eps(eps_),
+    preconditioner(NULL) {
+    if (krylov_size < 1 || SolutionData::FID_SOL_KRYLOV + krylov_size >= SolutionData::FID_SOL_MG) {
+        char msg[100];
+        sprintf(msg, "krylov_size must be between 1 and %d\n",
+            SolutionData::FID_SOL_MG - SolutionData::FID_SOL_KRYLOV - 1);
+        runtime->print_once(ctx, stderr, msg);
+        exit(EXIT_FAILURE);
+    }
+    solution_data.use_state();
+    solution_data.allocate_field(SolutionData::FID_SOL_NEWTON_UN, "sol_newton_previous_state");
+    solution_data.allocate_field(SolutionData::FID_SOL_NEWTON_R0, "sol_newton_residual");
+    solution_data.allocate_field(SolutionData::FID_SOL_NEWTON_SAVE, "sol_newton_saved_state");
+    for (int i=0; i<=krylov_size; i++) {
+        solution_data.allocate_field(SolutionData::FID_SOL_KRYLOV + i,
+            "sol_krylov_" + to_string(i));
+    }
+}
+
+void NewtonKrylov::set_preconditioner(Preconditioner *preconditioner_) {
+    preconditioner = preconditioner_;
+    if (preconditioner != NULL) {
+        solution_data.allocate_field(SolutionData::FID_SOL_PRECONDITIONED,
+            "sol_newton_preconditioned");
+    }
+}
+
+rtype NewtonKrylov::preconditioner_defect(JacobianData &jacobian_data) {
+    const FieldID v = SolutionData::FID_SOL_KRYLOV, w = v + 1;
+    solution_data.fill_field(v, 1.);
+    preconditioner->apply(solution_data, v, SolutionData::FID_SOL_PRECONDITIONED);
+    jacobian_data.spmv(solution_data, SolutionData::FID_SOL_PRECONDITIONED, w);
+    axpby(w, 1., v, -1.);
+    return sqrt(dot(w, w).get_result<rtype>()/dot(v, v).get_result<rtype>());
+}
+
+void NewtonKrylov::linear_combination(const LinCombArgs &arg, const Future *future) {
+    IndexLauncher index_launcher(LINEAR_COMBINATION_TASK_ID, solution_data.domain,
+        TaskArgument(&arg, sizeof(LinCombArgs)), ArgumentMap());
+    if (future != NULL) index_launcher.add_future(*future);
+    RegionRequirement req(solution_data.elem_lp, 0, READ_WRITE, EXCLUSIVE, solution_data.elem_lr);
+    req.add_field(arg.y);
+    index_launcher.add_region_requirement(req);
+    if (arg.nx > 0) {
+        set<FieldID> fields(arg.x, arg.x + arg.nx);
+        req = RegionRequirement(solution_data.elem_lp, 0, READ_ONLY, EXCLUSIVE,
+            solution_data.elem_lr);
+        for (auto fid: fields) req.add_field(fid);
+        index_launcher.add_region_requirement(req);
+    }
+    runtime->execute_index_space(ctx, index_launcher);
+}
+
+void NewtonKrylov::axpby(const FieldID y, const rtype a0, const FieldID x, const rtype a) {
+    LinCombArgs arg;
+    arg.y = y;
+    arg.nx = 1;
+    arg.x[0] = x;
+    arg.a0 = a0;
+    arg.a[0] = a;
+    arg.future_mode = 0;
+    linear_combination(arg);
+}
+
+Future NewtonKrylov::dot(const FieldID x, const FieldID y) {
+    DotArgs arg;
+    arg.x = x;
+    arg.y = y;
+    IndexLauncher index_launcher(DOT_TASK_ID, solution_data.domain,
+        TaskArgument(&arg, sizeof(DotArgs)), ArgumentMap());
+    RegionRequirement req(solution_data.elem_lp, 0, READ_ONLY, EXCLUSIVE, solution_data.elem_lr);
+    req.add_field(x);
+    if (y != x) req.add_field(y);
+    index_launcher.add_region_requirement(req);
+    return runtime->execute_index_space(ctx, index_launcher, SumReduction<rtype>::REDOP_ID);
+}
+
+void NewtonKrylov::evaluate(const function<void(const Predicate &)> &residual) {
+    solution_data.fill_field(SolutionData::FID_SOL_RESIDUAL, 0.);
+    residual(Predicate::TRUE_PRED);
+}
+
+void NewtonKrylov::jacobian_vector(const function<void(const Predicate &)> &residual,
+                                   const FieldID src, const FieldID dst) {
+    FDStepArgs step_arg;
+    step_arg.eps = eps;
+    TaskLauncher launcher(FD_STEP_TASK_ID, TaskArgument(&step_arg, sizeof(FDStepArgs)));
+    launcher.add_future(state_norm2);
+    launcher.add_future(dot(src, src));
+    Future h = runtime->execute_task(ctx, launcher);
+
+    solution_data.copy_field(SolutionData::FID_SOL_STATE, SolutionData::FID_SOL_NEWTON_SAVE);
+    LinCombArgs arg;
+    arg.y = SolutionData::FID_SOL_STATE;
+    arg.nx = 1;
+    arg.x[0] = src;
+    arg.a0 = 1.;
+    arg.a[0] = 1.;
+    arg.future_mode = 1;
+    linear_combination(arg, &h);
+    evaluate(residual);
+    // dst = src/dt - (R(U + h src) - R(U))/h
+    arg.y = dst;
+    arg.nx = 3;
+    arg.x[0] = src;
+    arg.x[1] = SolutionData::FID_SOL_RESIDUAL;
+    arg.x[2] = SolutionData::FID_SOL_NEWTON_R0;
+    arg.a0 = 0.;
+    arg.a[0] = 1./dt;
+    arg.a[1] = -1.;
+    arg.a[2] = 1.;
+    arg.future_mode = 2;
+    linear_combination(arg, &h);
+    solution_data.restore(SolutionData::FID_SOL_STATE, SolutionData::FID_SOL_NEWTON_SAVE);
+}
+
+void NewtonKrylov::step(const function<void(const Predicate &)> &residual, const Predicate &pred) {
+    if (!runtime->get_predicate_future(ctx, pred).get_result<bool>()) return;
+    const FieldID V0 = SolutionData::FID_SOL_KRYLOV;
+    solution_data.snapshot(SolutionData::FID_SOL_STATE, SolutionData::FID_SOL_NEWTON_UN);
+
+    for (int newton=0; newton<newton_iterations; newton++) {
+        // right-hand side -F(U) = R(U) - (U - U^n)/dt
+        evaluate(residual);
+        solution_data.copy_field(SolutionData::FID_SOL_RESIDUAL, SolutionData::FID_SOL_NEWTON_R0);
+        state_norm2 = dot(SolutionData::FID_SOL_STATE, SolutionData::FID_SOL_STATE);
+        LinCombArgs arg;
+        arg.y = V0;
+        arg.nx = 3;
+        arg.x[0] = SolutionData::FID_SOL_STATE;
+        arg.x[1] = SolutionData::FID_SOL_NEWTON_UN;
+        arg.x[2] = SolutionData::FID_SOL_NEWTON_R0;
+        arg.a0 = 0.;
+        arg.a[0] = -1./dt;
+        arg.a[1] = 1./dt;
+        arg.a[2] = 1.;
+        arg.future_mode = 0;
+        linear_combination(arg);
+        rtype beta = sqrt(dot(V0, V0).get_result<rtype>());
+
+        char msg[100];
+        sprintf(msg, "Newton iteration %d: |F| = %.10e\n", newton, beta);
+        runtime->print_once(ctx, stdout, msg);
+        if (beta <= newton_tolerance) break;
+
+        // GMRES from a zero initial guess, Arnoldi with modified Gram-Schmidt
+        arg.nx = 0;
+        arg.a0 = 1./beta;
+        linear_combination(arg);
+        vector<vector<rtype>> H(krylov_size + 1, vector<rtype>(krylov_size, 0.));
+        vector<rtype> g(krylov_size + 1, 0.), cs(krylov_size, 0.), sn(krylov_size, 0.);
+        g[0] = beta;
+        int m = 0;
+        for (int j=0; j<krylov_size; j++) {
+            const FieldID w = V0 + j + 1;
+            if (preconditioner != NULL) {
+                preconditioner->apply(solution_data, V0 + j, SolutionData::FID_SOL_PRECONDITIONED);
+                jacobian_vector(residual, SolutionData::FID_SOL_PRECONDITIONED, w);
+            }
+            else {
+                jacobian_vector(residual, V0 + j, w);
+            }
+            vector<Future> h(j + 1);
+            for (int i=0; i<=j; i++) {
+                h[i] = dot(w, V0 + i);
+                LinCombArgs orth;
+                orth.y = w;
+                orth.nx = 1;
+                orth.x[0] = V0 + i;
+                orth.a0 = 1.;
+                orth.a[0] = -1.;
+                orth.future_mode = 1;
+                linear_combination(orth, &h[i]);
+            }
+            // the only wait of the iteration, the dot products above are complete afterwards
+            H[j+1][j] = sqrt(dot(w, w).get_result<rtype>());
+            for (int i=0; i<=j; i++) H[i][j] = h[i].get_result<rtype>();
+            m = j + 1;
+
+            // Givens rotations keep the Hessenberg matrix upper triangular
+            for (int i=0; i<j; i++) {
+                rtype tmp = cs[i]*H[i][j] + sn[i]*H[i+1][j];
+                H[i+1][j] = -sn[i]*H[i][j] + cs[i]*H[i+1][j];
+                H[i][j] = tmp;
+            }
+            rtype r = sqrt(H[j][j]*H[j][j] + H[j+1][j]*H[j+1][j]);
+            bool breakdown = H[j+1][j] <= 1e-14*r;
+            if (!breakdown) {
+                LinCombArgs normalize;
+                normalize.y = w;
+                normalize.nx = 0;
+                normalize.a0 = 1./H[j+1][j];
+                normalize.future_mode = 0;
+                linear_combination(normalize);
+            }
+            cs[j] = H[j][j]/r;
+            sn[j] = H[j+1][j]/r;
+            H[j][j] = r;
+            H[j+1][j] = 0.;
+            g[j+1] = -sn[j]*g[j];
+            g[j] = cs[j]*g[j];
+            if (breakdown || fabs(g[j+1]) <= gmres_tolerance*beta) break;
+        }
+
+        // back substitution and update of the state, U += sum_i y_i v_i (preconditioned)
+        vector<rtype> y(m, 0.);
+        for (int i=m-1; i>=0; i--) {
+            y[i] = g[i];
+            for (int k=i+1; k<m; k++) y[i] -= H[i][k]*y[k];
+            y[i] /= H[i][i];
+        }
+        if (preconditioner != NULL) {
+            // the last basis vector is not part of the update and holds the sum
+            const FieldID sum = V0 + m;
+            axpby(sum, 0., V0, y[0]);
+            for (int i=1; i<m; i++) axpby(sum, 1., V0 + i, y[i]);
+            preconditioner->apply(solution_data, sum, SolutionData::FID_SOL_PRECONDITIONED);
+            axpby(SolutionData::FID_SOL_STATE, 1., SolutionData::FID_SOL_PRECONDITIONED, 1.);
+        }
+        else {
+            for (int i=0; i<m; i++) axpby(SolutionData::FID_SOL_STATE, 1., V0 + i, y[i]);
+        }
+    }
+
+    // leave the residual evaluated by the last Newton iteration in the residual field
+    solution_data.copy_field(SolutionData::FID_SOL_NEWTON_R0, SolutionData::FID_SOL_RESIDUAL);
+    time += dt;
+}
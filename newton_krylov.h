@@ -0,0 +1,165 @@
+//
+// Created by kihiro on 6/8/20.
+//
+
+#ifndef DG_NEWTON_KRYLOV_H
+#define DG_NEWTON_KRYLOV_H
+
+#include <functional>
+#include <vector>
+#include "legion.h"
+#include "mesh_data.h"
+#include "preconditioner.h"
+#include "solution_data.h"
+
+/*! \brief Arguments of the linear combination task
+ *
+ * y = a0*y + sum_i a[i]*x[i]. With future_mode 1, the coefficient a[0] is multiplied by the value
+ * of the task's future, which lets a dot product feed the update without waiting for it. With
+ * future_mode 2, the coefficients a[1] and a[2] are divided by it instead.
+ */
+struct LinCombArgs {
+    Legion::FieldID y; //!< updated field
+    int nx; //!< number of other fields (at most 3)
+    Legion::FieldID x[3]; //!< other fields
+    rtype a0; //!< weight of y
+    rtype a[3]; //!< weights of the other fields
+    int future_mode; //!< 0: no future, 1: multiply a[0] by the future, 2: divide a[1], a[2] by it
+};
+
+/*! \brief Arguments of the dot product task
+ *
+ */
+struct DotArgs {
+    Legion::FieldID x; //!< first field
+    Legion::FieldID y; //!< second field
+};
+
+/*! \brief Arguments of the finite difference step task
+ *
+ * The task's futures are U.U and v.v, it returns eps*(1 + |U|)/|v|.
+ */
+struct FDStepArgs {
+    rtype eps; //!< relative step
+};
+
+/*! \brief Matrix-free Newton-GMRES solver for backward Euler steps
+ *
+ * Each step solves F(U) = (U - U^n)/dt - R(U) = 0 for the solution state FID_SOL_STATE by Newton's
+ * method, the linear systems being solved by GMRES (at most krylov_size iterations, no restart)
+ * with modified Gram-Schmidt.
+ * Jacobian-vector products are finite differences of residual evaluations:
+ * J v = v/dt - (R(U + h v) - R(U))/h, with h = eps*(1 + |U|)/|v| and eps defaulting to the square
+ * root of the machine epsilon of the residual storage (stype), which balances truncation and
+ * round-off errors whatever the scale of U and v. In mixed precision builds the residuals are
+ * rounded to single precision, a step sized for rtype would only difference their round-off.
+ *
+ * With a preconditioner M, GMRES is right preconditioned: it solves J M^-1 u = -F and the Newton
+ * update is M^-1 u, so the residual norms it monitors are the true ones.
+ *
+ * All vectors are fields of the solution field space (the Krylov basis is allocated on
+ * construction) and all operations are index launches over the element partition. Dot products
+ * are futures reduced with SumReduction and consumed by the following launches without blocking,
+ * the finite difference step included. The top level waits once per GMRES iteration, for the norm
+ * of the new Krylov vector, to update the Givens rotations and detect convergence or breakdown; the
+ * Gram-Schmidt dot products it reads then are complete since the norm depends on them.
+ */
+class NewtonKrylov : public LegionData {
+  public:
+    /*! \brief Pre-register all implicit solver related tasks
+     *
+     */
+    static void register_tasks();
+
+    /*! \brief Constructor
+     *
+     * @param ctx Legion's context
+     * @param runtime Legion's runtime
+     * @param logger
+     * @param solution_data solution regions holding the state
+     * @param dt time step
+     * @param krylov_size maximum number of GMRES iterations per Newton iteration, its basis fields
+     * must fit between FID_SOL_KRYLOV and FID_SOL_MG (exits otherwise)
+     * @param newton_iterations maximum number of Newton iterations per step
+     * @param newton_tolerance absolute tolerance on the norm of F
+     * @param gmres_tolerance relative tolerance of the linear solves
+     * @param eps relative finite difference step of the Jacobian-vector products
+     */
+    NewtonKrylov(Legion::Context ctx, Legion::HighLevelRuntime *runtime, Legion::Logger &logger,
+                 SolutionData &solution_data, const rtype dt, const int krylov_size,
+                 const int newton_iterations, const rtype newton_tolerance,
+                 const rtype gmres_tolerance, const rtype eps);
+
+    /*! \brief Advance the state by one backward Euler step
+     *
+     * Blocks on the norms of the Krylov vectors. The Newton solve branches on them, so it cannot
+     * be predicated: the step first waits for the predicate and is skipped when it is false.
+     *
+     * @param residual issues the launches accumulating the residual of the current state
+     * @param pred the step is only taken if true (e.g. while the run has not converged)
+     */
+    void step(const std::function<void(const Legion::Predicate &)> &residual,
+              const Legion::Predicate &pred = Legion::Predicate::TRUE_PRED);
+
+    /*! \brief Right precondition the linear solves
+     *
+     * @param preconditioner factored preconditioner, owned by the caller (NULL to disable)
+     */
+    void set_preconditioner(Preconditioner *preconditioner);
+
+    /*! \brief Relative defect |v - J M^-1 v|/|v| of the preconditioner on v = 1
+     *
+     * J is applied with the block SpMV of the assembled Jacobian, so the defect measures what the
+     * preconditioner drops (couplings to other partitions, ILU fill-in). Blocks, and overwrites
+     * the first two Krylov fields, so it must be called between steps.
+     *
+     * @param jacobian_data Jacobian the preconditioner was factored from
+     * @return relative defect
+     */
+    rtype preconditioner_defect(JacobianData &jacobian_data);
+
+    rtype dt; //!< time step
+    rtype time; //!< physical time reached by the issued steps
+
+  private:
+    /*! \brief Evaluate the residual of the current state into FID_SOL_RESIDUAL
+     *
+     */
+    void evaluate(const std::function<void(const Legion::Predicate &)> &residual);
+
+    /*! \brief dst = J src by finite differences
+     *
+     * The step is computed by a task from the futures state_norm2 and src.src.
+     */
+    void jacobian_vector(const std::function<void(const Legion::Predicate &)> &residual,
+                         const Legion::FieldID src, const Legion::FieldID dst);
+
+    /*! \brief Dot product of two fields
+     *
+     * @return future holding the dot product
+     */
+    Legion::Future dot(const Legion::FieldID x, const Legion::FieldID y);
+
+    /*! \brief Launch a linear combination of fields
+     *
+     * @param arg fields and coefficients
+     * @param future optional future scaling a[0] (see LinCombArgs)
+     */
+    void linear_combination(const LinCombArgs &arg, const Legion::Future *future = NULL);
+
+    /*! \brief y = a0*y + a*x
+     *
+     */
+    void axpby(const Legion::FieldID y, const rtype a0, const Legion::FieldID x, const rtype a);
+
+    SolutionData &solution_data; //!< solution regions
+    int krylov_size; //!< maximum number of GMRES iterations
+    int newton_iterations; //!< maximum number of Newton iterations
+    rtype newton_tolerance; //!< absolute tolerance of the Newton iterations
+    rtype gmres_tolerance; //!< relative tolerance of GMRES
+    rtype eps; //!< relative finite difference step
+    Legion::Future state_norm2; //!< U.U for the current Newton iteration
+    Preconditioner *preconditioner; //!< optional right preconditioner
+};
+
+#endif //DG_NEWTON_KRYLOV_H
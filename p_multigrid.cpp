@@ -0,0 +1,452 @@
+//
+// Created by kihiro on 6/29/20.
+//
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "legion.h"
+#include "p_multigrid.h"
+#include "basis.h"
+#include "ids.h"
+#include "redop.h"
+#include "typedefs.h"
+
+using namespace Legion;
+using namespace LegionRuntime;
+using namespace std;
+
+static_assert(N_ORDER < MG_ORDER_IDS, "p-multigrid task IDs are reserved for orders up to 3");
+
+/*! \brief Reduction operator of the residual of order p
+ *
+ * Every order has its own, the level fields being stored as rtype unlike the main residual.
+ */
+static ReductionOpID mg_redop_id(const int p) {
+    return REDOP_MG_SUM_ID + p;
+}
+
+template <int p>
+void mg_elem_residual_task(const Task *task, const std::vector<PhysicalRegion> &regions,
+                           Context ctx, Runtime *runtime) {
+    const int n = N_REDOP_P(p);
+    MGArgs arg = *(const MGArgs *)task->args;
+    const AffAccROrtype acc_u(regions[0], PMultigrid::fid(p, PMultigrid::MG_SOLUTION),
+        n*sizeof(rtype));
+    AffAccROrtype acc_f;
+    if (arg.forcing) {
+        acc_f = AffAccROrtype(regions[0], PMultigrid::fid(p, PMultigrid::MG_FORCING),
+            n*sizeof(rtype));
+    }
+    const AffAccWDrtype acc_r(regions[1], PMultigrid::fid(p, PMultigrid::MG_RESIDUAL),
+        n*sizeof(rtype));
+
+    Domain domain = runtime->get_index_space_domain(ctx, task->regions[0].region.get_index_space());
+    for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+        const rtype *u = acc_u.ptr(itr.p);
+        rtype *r = acc_r.ptr(itr.p);
+        for (int k=0; k<n; k++) r[k] = -arg.sigma*u[k];
+        if (arg.source) {
+            for (int k=0; k<n; k++) r[k] += (rtype) (k+1) / (rtype) n;
+        }
+        if (arg.forcing) {
+            const rtype *f = acc_f.ptr(itr.p);
+            for (int k=0; k<n; k++) r[k] += f[k];
+        }
+    }
+}
+
+template <int p>
+void mg_iface_residual_task(const Task *task, const std::vector<PhysicalRegion> &regions,
+                            Context ctx, Runtime *runtime) {
+    const int n = N_REDOP_P(p);
+    const AffAccROPoint1 acc_elemL(regions[0], MeshData::FID_MESH_IFACE_ELEMLID,
+        sizeof(Point<1>));
+    const AffAccROPoint1 acc_elemR(regions[0], MeshData::FID_MESH_IFACE_ELEMRID,
+        sizeof(Point<1>));
+    const AffAccROrtype acc_u(regions[1], PMultigrid::fid(p, PMultigrid::MG_SOLUTION),
+        n*sizeof(rtype));
+    ReductionAccessor<ReductionSum<n>, true, // exclusive
+            1, coord_t, Realm::AffineAccessor<typename ReductionSum<n>::LHS, 1, coord_t> >
+            acc_r(regions[2], PMultigrid::fid(p, PMultigrid::MG_RESIDUAL), mg_redop_id(p));
+
+    Domain domain = runtime->get_index_space_domain(ctx, task->regions[0].region.get_index_space());
+    typename ReductionSum<n>::RHS flux_L, flux_R;
+    for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+        // same face coefficients as the toy Jacobian
+        rtype c = (rtype) 1. / (rtype) (itr.p[0]%8 + 1);
+        Point<1> elemL = acc_elemL[*itr];
+        Point<1> elemR = acc_elemR[*itr];
+        const rtype *uL = acc_u.ptr(elemL);
+        const rtype *uR = acc_u.ptr(elemR);
+        for (int k=0; k<n; k++) {
+            flux_L.value[k] = c*(uR[k] - uL[k]);
+            flux_R.value[k] = -flux_L.value[k];
+        }
+        ReductionSum<n>::template apply<true>(*acc_r.ptr(elemL), flux_L);
+        ReductionSum<n>::template apply<true>(*acc_r.ptr(elemR), flux_R);
+    }
+}
+
+template <int p>
+void mg_smooth_task(const Task *task, const std::vector<PhysicalRegion> &regions,
+                    Context ctx, Runtime *runtime) {
+    const int n = N_REDOP_P(p);
+    MGArgs arg = *(const MGArgs *)task->args;
+    const AffAccROrtype acc_r(regions[0], PMultigrid::fid(p, PMultigrid::MG_RESIDUAL),
+        n*sizeof(rtype));
+    const AffAccRWrtype acc_u(regions[1], PMultigrid::fid(p, PMultigrid::MG_SOLUTION),
+        n*sizeof(rtype));
+    Domain domain = runtime->get_index_space_domain(ctx, task->regions[0].region.get_index_space());
+    for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+        const rtype *r = acc_r.ptr(itr.p);
+        rtype *u = acc_u.ptr(itr.p);
+        for (int k=0; k<n; k++) u[k] += arg.tau*r[k];
+    }
+}
+
+template <int p>
+void mg_forcing_task(const Task *task, const std::vector<PhysicalRegion> &regions,
+                     Context ctx, Runtime *runtime) {
+    const int n = N_REDOP_P(p);
+    const AffAccROrtype acc_r(regions[0], PMultigrid::fid(p, PMultigrid::MG_RESIDUAL),
+        n*sizeof(rtype));
+    const AffAccRWrtype acc_f(regions[1], PMultigrid::fid(p, PMultigrid::MG_FORCING),
+        n*sizeof(rtype));
+    Domain domain = runtime->get_index_space_domain(ctx, task->regions[0].region.get_index_space());
+    for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+        const rtype *r = acc_r.ptr(itr.p);
+        rtype *f = acc_f.ptr(itr.p);
+        // restricted fine residual minus the coarse operator of the restricted solution
+        for (int k=0; k<n; k++) f[k] -= r[k];
+    }
+}
+
+template <int p>
+rtype mg_norm_task(const Task *task, const std::vector<PhysicalRegion> &regions,
+                   Context ctx, Runtime *runtime) {
+    const int n = N_REDOP_P(p);
+    const AffAccROrtype acc_r(regions[0], PMultigrid::fid(p, PMultigrid::MG_RESIDUAL),
+        n*sizeof(rtype));
+    Domain domain = runtime->get_index_space_domain(ctx, task->regions[0].region.get_index_space());
+    rtype result = 0.;
+    for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+        const rtype *r = acc_r.ptr(itr.p);
+        for (int k=0; k<n; k++) result += r[k]*r[k];
+    }
+    return result;
+}
+
+template <int p>
+void mg_restrict_task(const Task *task, const std::vector<PhysicalRegion> &regions,
+                      Context ctx, Runtime *runtime) {
+    const int nbf = N_BASIS(p), nbc = N_BASIS(p-1);
+    const rtype *proj = (const rtype *)task->args;
+    const AffAccROrtype acc_uf(regions[0], PMultigrid::fid(p, PMultigrid::MG_SOLUTION),
+        N_STATE*nbf*sizeof(rtype));
+    const AffAccROrtype acc_rf(regions[0], PMultigrid::fid(p, PMultigrid::MG_RESIDUAL),
+        N_STATE*nbf*sizeof(rtype));
+    const AffAccWDrtype acc_uc(regions[1], PMultigrid::fid(p-1, PMultigrid::MG_SOLUTION),
+        N_STATE*nbc*sizeof(rtype));
+    const AffAccWDrtype acc_sc(regions[1], PMultigrid::fid(p-1, PMultigrid::MG_SAVED),
+        N_STATE*nbc*sizeof(rtype));
+    const AffAccWDrtype acc_fc(regions[1], PMultigrid::fid(p-1, PMultigrid::MG_FORCING),
+        N_STATE*nbc*sizeof(rtype));
+
+    Domain domain = runtime->get_index_space_domain(ctx, task->regions[0].region.get_index_space());
+    for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+        const rtype *uf = acc_uf.ptr(itr.p);
+        const rtype *rf = acc_rf.ptr(itr.p);
+        rtype *uc = acc_uc.ptr(itr.p);
+        rtype *sc = acc_sc.ptr(itr.p);
+        rtype *fc = acc_fc.ptr(itr.p);
+        for (int s=0; s<N_STATE; s++) {
+            for (int i=0; i<nbc; i++) {
+                rtype u = 0., r = 0.;
+                for (int j=0; j<nbf; j++) {
+                    u += proj[i*nbf + j]*uf[s*nbf + j];
+                    r += proj[i*nbf + j]*rf[s*nbf + j];
+                }
+                uc[s*nbc + i] = u;
+                sc[s*nbc + i] = u;
+                fc[s*nbc + i] = r;
+            }
+        }
+    }
+}
+
+template <int p>
+void mg_prolongate_task(const Task *task, const std::vector<PhysicalRegion> &regions,
+                        Context ctx, Runtime *runtime) {
+    const int nbf = N_BASIS(p), nbc = N_BASIS(p-1);
+    const rtype *interp = (const rtype *)task->args + nbc*nbf;
+    const AffAccROrtype acc_uc(regions[0], PMultigrid::fid(p-1, PMultigrid::MG_SOLUTION),
+        N_STATE*nbc*sizeof(rtype));
+    const AffAccROrtype acc_sc(regions[0], PMultigrid::fid(p-1, PMultigrid::MG_SAVED),
+        N_STATE*nbc*sizeof(rtype));
+    const AffAccRWrtype acc_uf(regions[1], PMultigrid::fid(p, PMultigrid::MG_SOLUTION),
+        N_STATE*nbf*sizeof(rtype));
+
+    rtype correction[nbc];
+    Domain domain = runtime->get_index_space_domain(ctx, task->regions[0].region.get_index_space());
+    for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+        const rtype *uc = acc_uc.ptr(itr.p);
+        const rtype *sc = acc_sc.ptr(itr.p);
+        rtype *uf = acc_uf.ptr(itr.p);
+        for (int s=0; s<N_STATE; s++) {
+            for (int j=0; j<nbc; j++) correction[j] = uc[s*nbc + j] - sc[s*nbc + j];
+            for (int i=0; i<nbf; i++) {
+                rtype du = 0.;
+                for (int j=0; j<nbc; j++) du += interp[i*nbc + j]*correction[j];
+                uf[s*nbf + i] += du;
+            }
+        }
+    }
+}
+
+/*! \brief Register the tasks of order p and of all lower orders
+ *
+ * The transfer tasks of order p go between p and p-1, so order 0 only has the level tasks.
+ */
+template <int p>
+struct MGTasks {
+    static void register_level_tasks() {
+        {
+            TaskVariantRegistrar registrar(MG_ELEM_RESIDUAL_TASK_ID + p, "mg_elem_residual_task");
+            registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+            registrar.set_leaf();
+            Runtime::preregister_task_variant<mg_elem_residual_task<p>> (registrar,
+                "mg_elem_residual_task");
+        }
+        {
+            TaskVariantRegistrar registrar(MG_IFACE_RESIDUAL_TASK_ID + p,
+                "mg_iface_residual_task");
+            registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+            registrar.set_leaf();
+            Runtime::preregister_task_variant<mg_iface_residual_task<p>> (registrar,
+                "mg_iface_residual_task");
+        }
+        {
+            TaskVariantRegistrar registrar(MG_SMOOTH_TASK_ID + p, "mg_smooth_task");
+            registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+            registrar.set_leaf();
+            Runtime::preregister_task_variant<mg_smooth_task<p>> (registrar, "mg_smooth_task");
+        }
+        {
+            TaskVariantRegistrar registrar(MG_FORCING_TASK_ID + p, "mg_forcing_task");
+            registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+            registrar.set_leaf();
+            Runtime::preregister_task_variant<mg_forcing_task<p>> (registrar, "mg_forcing_task");
+        }
+        {
+            TaskVariantRegistrar registrar(MG_NORM_TASK_ID + p, "mg_norm_task");
+            registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+            registrar.set_leaf();
+            Runtime::preregister_task_variant<rtype, mg_norm_task<p>> (registrar, "mg_norm_task");
+        }
+        Runtime::register_reduction_op<ReductionSum<N_REDOP_P(p)>>(REDOP_MG_SUM_ID + p);
+    }
+
+    static void register_tasks() {
+        register_level_tasks();
+        {
+            TaskVariantRegistrar registrar(MG_RESTRICT_TASK_ID + p, "mg_restrict_task");
+            registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+            registrar.set_leaf();
+            Runtime::preregister_task_variant<mg_restrict_task<p>> (registrar,
+                "mg_restrict_task");
+        }
+        {
+            TaskVariantRegistrar registrar(MG_PROLONGATE_TASK_ID + p, "mg_prolongate_task");
+            registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+            registrar.set_leaf();
+            Runtime::preregister_task_variant<mg_prolongate_task<p>> (registrar,
+                "mg_prolongate_task");
+        }
+        MGTasks<p-1>::register_tasks();
+    }
+};
+
+template <>
+void MGTasks<0>::register_tasks() {
+    register_level_tasks();
+}
+
+void PMultigrid::register_tasks() {
+    MGTasks<N_ORDER>::register_tasks();
+}
+
+PMultigrid::PMultigrid(Context ctx, HighLevelRuntime *runtime, Legion::Logger &logger,
+                       const MeshData &mesh_data_, SolutionData &solution_data_, const int p_min_,
+                       const int nu1_, const int nu2_, const int nu_coarse_, const rtype omega,
+                       const rtype sigma_) :
+    LegionData(ctx, runtime, logger), mesh_data(mesh_data_), solution_data(solution_data_),
+    p_min(p_min_), nu1(nu1_), nu2(nu2_), nu_coarse(nu_coarse_), sigma(sigma_),
+    transfer(N_ORDER + 1) {
+    if (p_min < 0 || p_min > N_ORDER) {
+        runtime->print_once(ctx, stderr,
+            "The coarsest p-multigrid order must be in [0, N_ORDER]\n");
+        exit(EXIT_FAILURE);
+    }
+    // Jacobi damping by the largest diagonal of the model operator (face coefficients are <= 1)
+    tau = omega / (sigma + 2*solution_data.dim);
+
+    solution_data.use_state();
+    for (int p=p_min; p<=N_ORDER; p++) {
+        size_t size = N_REDOP_P(p)*sizeof(rtype);
+        string suffix = "_p" + to_string(p);
+        solution_data.allocate_field(fid(p, MG_SOLUTION), "sol_mg_solution" + suffix, size);
+        solution_data.allocate_field(fid(p, MG_RESIDUAL), "sol_mg_residual" + suffix, size);
+        if (p == N_ORDER) continue;
+        solution_data.allocate_field(fid(p, MG_FORCING), "sol_mg_forcing" + suffix, size);
+        solution_data.allocate_field(fid(p, MG_SAVED), "sol_mg_saved" + suffix, size);
+    }
+
+    // tensor products of the 1D transfer operators, nodes being ordered lexicographically
+    for (int p=p_min+1; p<=N_ORDER; p++) {
+        int nf1 = p+1, nc1 = p, nbf = N_BASIS(p), nbc = N_BASIS(p-1);
+        vector<rtype> proj1(nc1*nf1), interp1(nf1*nc1);
+        l2_projection_1d(p, p-1, proj1.data());
+        interpolation_1d(p, p-1, interp1.data());
+        vector<rtype> &op = transfer[p];
+        op.assign(2*nbc*nbf, 1.);
+        for (int i=0; i<nbc; i++) {
+            for (int j=0; j<nbf; j++) {
+                int ci = i, fj = j;
+                for (int d=0; d<N_DIM; d++) {
+                    op[i*nbf + j] *= proj1[(ci%nc1)*nf1 + fj%nf1];
+                    op[nbc*nbf + j*nbc + i] *= interp1[(fj%nf1)*nc1 + ci%nc1];
+                    ci /= nc1;
+                    fj /= nf1;
+                }
+            }
+        }
+    }
+}
+
+void PMultigrid::launch_elem_task(const TaskID task_id, const TaskArgument &arg,
+                                  const vector<FieldID> &read, const vector<FieldID> &write,
+                                  const PrivilegeMode write_mode) {
+    IndexLauncher index_launcher(task_id, solution_data.domain, arg, ArgumentMap());
+    RegionRequirement req(solution_data.elem_lp, 0, READ_ONLY, EXCLUSIVE, solution_data.elem_lr);
+    for (auto field: read) req.add_field(field);
+    index_launcher.add_region_requirement(req);
+    req = RegionRequirement(solution_data.elem_lp, 0, write_mode, EXCLUSIVE,
+        solution_data.elem_lr);
+    for (auto field: write) req.add_field(field);
+    index_launcher.add_region_requirement(req);
+    runtime->execute_index_space(ctx, index_launcher);
+}
+
+void PMultigrid::residual(const int p, const bool forcing) {
+    MGArgs arg;
+    arg.sigma = sigma;
+    arg.tau = tau;
+    arg.forcing = forcing;
+    arg.source = p == N_ORDER;
+    vector<FieldID> read = {fid(p, MG_SOLUTION)};
+    if (forcing) read.push_back(fid(p, MG_FORCING));
+    launch_elem_task(MG_ELEM_RESIDUAL_TASK_ID + p, TaskArgument(&arg, sizeof(MGArgs)), read,
+        {fid(p, MG_RESIDUAL)}, WRITE_DISCARD);
+
+    IndexLauncher index_launcher(MG_IFACE_RESIDUAL_TASK_ID + p, solution_data.domain,
+        TaskArgument(), ArgumentMap());
+    RegionRequirement req(mesh_data.iface_lp, 0, READ_ONLY, EXCLUSIVE, mesh_data.iface_lr);
+    req.add_field(MeshData::FID_MESH_IFACE_ELEMLID);
+    req.add_field(MeshData::FID_MESH_IFACE_ELEMRID);
+    index_launcher.add_region_requirement(req);
+    req = RegionRequirement(solution_data.elem_with_halo_lp, 0, READ_ONLY, EXCLUSIVE,
+        solution_data.elem_lr);
+    req.add_field(fid(p, MG_SOLUTION));
+    index_launcher.add_region_requirement(req);
+    req = RegionRequirement(solution_data.elem_with_halo_lp, 0, mg_redop_id(p), EXCLUSIVE,
+        solution_data.elem_lr);
+    req.add_field(fid(p, MG_RESIDUAL));
+    index_launcher.add_region_requirement(req);
+    runtime->execute_index_space(ctx, index_launcher);
+}
+
+void PMultigrid::smooth(const int p, const int nu) {
+    MGArgs arg;
+    arg.sigma = sigma;
+    arg.tau = tau;
+    arg.forcing = p < N_ORDER;
+    arg.source = p == N_ORDER;
+    for (int i=0; i<nu; i++) {
+        residual(p, p < N_ORDER);
+        launch_elem_task(MG_SMOOTH_TASK_ID + p, TaskArgument(&arg, sizeof(MGArgs)),
+            {fid(p, MG_RESIDUAL)}, {fid(p, MG_SOLUTION)}, READ_WRITE);
+    }
+}
+
+void PMultigrid::restrict_level(const int p) {
+    launch_elem_task(MG_RESTRICT_TASK_ID + p,
+        TaskArgument(transfer[p].data(), transfer[p].size()*sizeof(rtype)),
+        {fid(p, MG_SOLUTION), fid(p, MG_RESIDUAL)},
+        {fid(p-1, MG_SOLUTION), fid(p-1, MG_SAVED), fid(p-1, MG_FORCING)}, WRITE_DISCARD);
+    // FAS forcing: restricted residual minus the coarse operator of the restricted solution
+    residual(p-1, false);
+    launch_elem_task(MG_FORCING_TASK_ID + p - 1, TaskArgument(), {fid(p-1, MG_RESIDUAL)},
+        {fid(p-1, MG_FORCING)}, READ_WRITE);
+}
+
+void PMultigrid::prolongate(const int p) {
+    launch_elem_task(MG_PROLONGATE_TASK_ID + p,
+        TaskArgument(transfer[p].data(), transfer[p].size()*sizeof(rtype)),
+        {fid(p-1, MG_SOLUTION), fid(p-1, MG_SAVED)}, {fid(p, MG_SOLUTION)}, READ_WRITE);
+}
+
+void PMultigrid::vcycle(const int p) {
+    if (p == p_min) {
+        smooth(p, nu_coarse);
+        return;
+    }
+    smooth(p, nu1);
+    residual(p, p < N_ORDER);
+    restrict_level(p);
+    vcycle(p-1);
+    prolongate(p);
+    smooth(p, nu2);
+}
+
+rtype PMultigrid::residual_norm() {
+    residual(N_ORDER, false);
+    IndexLauncher index_launcher(MG_NORM_TASK_ID + N_ORDER, solution_data.domain,
+        TaskArgument(), ArgumentMap());
+    RegionRequirement req(solution_data.elem_lp, 0, READ_ONLY, EXCLUSIVE, solution_data.elem_lr);
+    req.add_field(fid(N_ORDER, MG_RESIDUAL));
+    index_launcher.add_region_requirement(req);
+    return sqrt(runtime->execute_index_space(ctx, index_launcher,
+        SumReduction<rtype>::REDOP_ID).get_result<rtype>());
+}
+
+int PMultigrid::solve(const int cycles, const rtype tolerance) {
+    vector<rtype> zero(N_REDOP, 0.);
+    IndexFillLauncher fill_launcher(solution_data.domain, solution_data.elem_lp,
+        solution_data.elem_lr, TaskArgument(zero.data(), N_REDOP*sizeof(rtype)));
+    fill_launcher.add_field(fid(N_ORDER, MG_SOLUTION));
+    runtime->fill_fields(ctx, fill_launcher);
+
+    int cycle = 0;
+    rtype norm = residual_norm();
+    char msg[100];
+    while (cycle < cycles && norm > tolerance) {
+        vcycle(N_ORDER);
+        cycle++;
+        rtype previous = norm;
+        norm = residual_norm();
+        sprintf(msg, "p-multigrid cycle %d: |R| = %.10e\n", cycle, norm);
+        runtime->print_once(ctx, stdout, msg);
+        if (!(norm < previous)) {
+            sprintf(msg, "p-multigrid cycle %d did not reduce |R| (%.10e before)\n", cycle,
+                previous);
+            runtime->print_once(ctx, stderr, msg);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    solution_data.copy_field(fid(N_ORDER, MG_SOLUTION), SolutionData::FID_SOL_STATE);
+    return cycle;
+}
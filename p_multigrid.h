@@ -0,0 +1,154 @@
+//
+// Created by kihiro on 6/29/20.
+//
+
+#ifndef DG_P_MULTIGRID_H
+#define DG_P_MULTIGRID_H
+
+#include <vector>
+#include "legion.h"
+#include "mesh_data.h"
+#include "solution_data.h"
+
+/*! \brief Arguments of the p-multigrid level tasks
+ *
+ */
+struct MGArgs {
+    rtype sigma; //!< reaction coefficient of the model operator
+    rtype tau; //!< pseudo time step of the smoother
+    int forcing; //!< add the FAS forcing of the level to the residual
+    int source; //!< add the source term to the residual (finest level)
+};
+
+/*! \brief Steady p-multigrid solver (full approximation scheme V-cycles)
+ *
+ * The levels are the polynomial orders N_ORDER (finest) down to p_min, all living on the solution
+ * element partition: order p has its own solution, residual, FAS forcing and saved restricted
+ * solution fields of N_REDOP_P(p) values, FID_SOL_MG + 4*p + MGFields. Residual launches of order p
+ * reduce face contributions with ReductionSum<N_REDOP_P(p)>, its tasks are instantiated per order.
+ *
+ * The level operator is a model steady problem in the spirit of the toy residual:
+ * R_p(U) = F_p + S - sigma U + sum_faces c_f (U_other - U), with the source S on the finest level
+ * only, smoothed by damped Jacobi (pseudo time stepping U += tau R). Solutions and residuals are
+ * restricted by L2 projection (keeping the coarse operator consistent with the FAS forcing) and
+ * corrections are prolongated by interpolation, all per-element dense operators built from the 1D
+ * ones by tensor products.
+ */
+class PMultigrid : public LegionData {
+  public:
+    /*! \brief Fields of one order, offsets from FID_SOL_MG + 4*p
+     *
+     */
+    enum MGFields {
+        MG_SOLUTION, //!< solution
+        MG_RESIDUAL, //!< residual
+        MG_FORCING, //!< FAS forcing (coarse levels)
+        MG_SAVED, //!< restricted solution before the coarse solve (coarse levels)
+    };
+
+    /*! \brief Field ID of a field of an order
+     *
+     */
+    static Legion::FieldID fid(const int p, const MGFields field) {
+        return SolutionData::FID_SOL_MG + 4*p + field;
+    }
+
+    /*! \brief Pre-register all p-multigrid related tasks and the level reduction operators
+     *
+     */
+    static void register_tasks();
+
+    /*! \brief Constructor
+     *
+     * Allocate the level fields.
+     *
+     * @param ctx Legion's context
+     * @param runtime Legion's runtime
+     * @param logger
+     * @param mesh_data mesh regions
+     * @param solution_data solution regions
+     * @param p_min coarsest order, in [0, N_ORDER] (exits otherwise)
+     * @param nu1 pre-smoothing iterations
+     * @param nu2 post-smoothing iterations
+     * @param nu_coarse smoothing iterations on the coarsest level
+     * @param omega damping of the smoother
+     * @param sigma reaction coefficient of the model operator
+     */
+    PMultigrid(Legion::Context ctx, Legion::HighLevelRuntime *runtime, Legion::Logger &logger,
+               const MeshData &mesh_data, SolutionData &solution_data, const int p_min,
+               const int nu1, const int nu2, const int nu_coarse, const rtype omega,
+               const rtype sigma);
+
+    /*! \brief Solve the finest level from a zero initial guess
+     *
+     * Blocks on the residual norm after every cycle and exits if a cycle does not reduce it. The
+     * solution is copied into FID_SOL_STATE.
+     *
+     * @param cycles maximum number of V-cycles
+     * @param tolerance absolute tolerance on the finest residual norm
+     * @return number of cycles done
+     */
+    int solve(const int cycles, const rtype tolerance);
+
+  private:
+    /*! \brief V-cycle from order p down to p_min
+     *
+     */
+    void vcycle(const int p);
+
+    /*! \brief Evaluate the finest residual without forcing and return its norm (blocking)
+     *
+     */
+    rtype residual_norm();
+
+    /*! \brief Evaluate the residual of order p
+     *
+     * @param forcing whether the FAS forcing is added
+     */
+    void residual(const int p, const bool forcing);
+
+    /*! \brief nu smoothing iterations on order p
+     *
+     */
+    void smooth(const int p, const int nu);
+
+    /*! \brief Restrict solution and residual from order p to order p-1, init the coarse forcing
+     *
+     */
+    void restrict_level(const int p);
+
+    /*! \brief Add the interpolated coarse correction of order p-1 to order p
+     *
+     */
+    void prolongate(const int p);
+
+    /*! \brief Launch an element task on the solution element partition
+     *
+     * @param task_id task ID
+     * @param arg task argument
+     * @param read fields read (first region requirement)
+     * @param write fields written (second region requirement)
+     * @param write_mode privilege of the written fields
+     */
+    void launch_elem_task(const Legion::TaskID task_id, const Legion::TaskArgument &arg,
+                          const std::vector<Legion::FieldID> &read,
+                          const std::vector<Legion::FieldID> &write,
+                          const Legion::PrivilegeMode write_mode);
+
+    const MeshData &mesh_data; //!< mesh regions
+    SolutionData &solution_data; //!< solution regions
+    int p_min; //!< coarsest order
+    int nu1; //!< pre-smoothing iterations
+    int nu2; //!< post-smoothing iterations
+    int nu_coarse; //!< coarsest level smoothing iterations
+    rtype sigma; //!< reaction coefficient
+    rtype tau; //!< pseudo time step of the smoother
+    /*! \brief Transfer operators between order p and p-1, indexed by p
+     *
+     * Per order: the L2 projection (N_BASIS(p-1) x N_BASIS(p)) followed by the interpolation
+     * (N_BASIS(p) x N_BASIS(p-1)), both row after row and applied state by state.
+     */
+    std::vector<std::vector<rtype>> transfer;
+};
+
+#endif //DG_P_MULTIGRID_H
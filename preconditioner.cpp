@@ -0,0 +1,229 @@
+//
+// Created by kihiro on 6/22/20.
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "legion.h"
+#include "preconditioner.h"
+#include "dense_block.h"
+#include "dense_lu.h"
+#include "ids.h"
+#include "redop.h"
+#include "typedefs.h"
+
+using namespace Legion;
+using namespace LegionRuntime;
+using namespace std;
+
+void factor_preconditioner_task(const Task *task, const std::vector<PhysicalRegion> &regions,
+                                Context ctx, Runtime *runtime) {
+    PCArgs arg = *(const PCArgs *)task->args;
+    const AffAccROrtype acc_diag(regions[0], JacobianData::FID_JAC_DIAG, N_BLOCK*sizeof(rtype));
+    const AffAccRORect1 acc_range(regions[0], JacobianData::FID_JAC_ROW_RANGE);
+    const AffAccWDrtype acc_lu(regions[1], JacobianData::FID_JAC_PC_LU, N_BLOCK*sizeof(rtype));
+    const AffAccWDint acc_piv(regions[1], JacobianData::FID_JAC_PC_PIVOT, N_REDOP*sizeof(int));
+
+    Domain domain = runtime->get_index_space_domain(ctx, task->regions[0].region.get_index_space());
+    if (arg.type == PC_BLOCK_JACOBI) {
+        // batched factorization of the diagonal blocks
+        for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+            rtype *lu = acc_lu.ptr(itr.p);
+            memcpy(lu, acc_diag.ptr(itr.p), N_BLOCK*sizeof(rtype));
+            block_lu_factor<N_REDOP>(lu, acc_piv.ptr(itr.p));
+        }
+        return;
+    }
+
+    const AffAccROPoint1 acc_col(regions[2], JacobianData::FID_JAC_BLOCK_COL);
+    const AffAccROrtype acc_block(regions[2], JacobianData::FID_JAC_BLOCK_VALUE,
+        N_BLOCK*sizeof(rtype));
+    const AffAccWDrtype acc_factor(regions[3], JacobianData::FID_JAC_PC_BLOCK,
+        N_BLOCK*sizeof(rtype));
+
+    // start from the partition's block rows, blocks coupling to other partitions are ignored
+    vector<Point<1>> elems;
+    for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+        elems.push_back(itr.p);
+        memcpy(acc_lu.ptr(itr.p), acc_diag.ptr(itr.p), N_BLOCK*sizeof(rtype));
+        Rect<1> range = acc_range[*itr];
+        for (PointInRectIterator<1> pir(range); pir(); pir++) {
+            memcpy(acc_factor.ptr(*pir), acc_block.ptr(*pir), N_BLOCK*sizeof(rtype));
+        }
+    }
+
+    // row-wise (IKJ) block ILU(0) in increasing element order, the blocks of a row being sorted
+    // by column
+    for (auto &elem: elems) {
+        coord_t i = elem[0];
+        Rect<1> range_i = acc_range[elem];
+        for (PointInRectIterator<1> b(range_i); b(); b++) {
+            Point<1> k = acc_col[*b];
+            if (k[0] >= i || !domain.contains(k)) continue;
+            // L_ik = A_ik U_kk^-1, then A_ij -= L_ik U_kj over the pattern of row i
+            rtype *L = acc_factor.ptr(*b);
+            block_lu_right_solve<N_REDOP>(acc_lu.ptr(k), acc_piv.ptr(k), L);
+            Rect<1> range_k = acc_range[k];
+            for (PointInRectIterator<1> b2(range_k); b2(); b2++) {
+                Point<1> j = acc_col[*b2];
+                if (j[0] <= k[0] || !domain.contains(j)) continue;
+                if (j[0] == i) {
+                    block_gemm_sub<N_REDOP>(L, acc_factor.ptr(*b2), acc_lu.ptr(elem));
+                    continue;
+                }
+                for (PointInRectIterator<1> b3(range_i); b3(); b3++) {
+                    if (acc_col[*b3][0] != j[0]) continue;
+                    block_gemm_sub<N_REDOP>(L, acc_factor.ptr(*b2), acc_factor.ptr(*b3));
+                    break;
+                }
+            }
+        }
+        block_lu_factor<N_REDOP>(acc_lu.ptr(elem), acc_piv.ptr(elem));
+    }
+}
+
+void apply_preconditioner_task(const Task *task, const std::vector<PhysicalRegion> &regions,
+                               Context ctx, Runtime *runtime) {
+    PCArgs arg = *(const PCArgs *)task->args;
+    const AffAccROrtype acc_lu(regions[0], JacobianData::FID_JAC_PC_LU, N_BLOCK*sizeof(rtype));
+    const AffAccROint acc_piv(regions[0], JacobianData::FID_JAC_PC_PIVOT, N_REDOP*sizeof(int));
+    // the solution fields follow the block region requirement, only present for ILU(0)
+    int isol = arg.type == PC_ILU0 ? 2 : 1;
+    const AffAccROrtype acc_r(regions[isol], arg.r, N_REDOP*sizeof(rtype));
+    const AffAccWDrtype acc_z(regions[isol + 1], arg.z, N_REDOP*sizeof(rtype));
+
+    Domain domain = runtime->get_index_space_domain(ctx, task->regions[0].region.get_index_space());
+    if (arg.type == PC_BLOCK_JACOBI) {
+        for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+            rtype *z = acc_z.ptr(itr.p);
+            memcpy(z, acc_r.ptr(itr.p), N_REDOP*sizeof(rtype));
+            block_lu_solve<N_REDOP>(acc_lu.ptr(itr.p), acc_piv.ptr(itr.p), z);
+        }
+        return;
+    }
+
+    const AffAccRORect1 acc_range(regions[0], JacobianData::FID_JAC_ROW_RANGE);
+    const AffAccROPoint1 acc_col(regions[1], JacobianData::FID_JAC_BLOCK_COL);
+    const AffAccROrtype acc_factor(regions[1], JacobianData::FID_JAC_PC_BLOCK,
+        N_BLOCK*sizeof(rtype));
+
+    // forward substitution with the unit block lower factor
+    vector<Point<1>> elems;
+    for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+        elems.push_back(itr.p);
+        rtype *z = acc_z.ptr(itr.p);
+        memcpy(z, acc_r.ptr(itr.p), N_REDOP*sizeof(rtype));
+        Rect<1> range = acc_range[*itr];
+        for (PointInRectIterator<1> b(range); b(); b++) {
+            Point<1> k = acc_col[*b];
+            if (k[0] >= itr.p[0] || !domain.contains(k)) continue;
+            block_gemv_sub<N_REDOP>(acc_factor.ptr(*b), acc_z.ptr(k), z);
+        }
+    }
+
+    // backward substitution with the block upper factor
+    for (auto elem=elems.rbegin(); elem!=elems.rend(); elem++) {
+        rtype *z = acc_z.ptr(*elem);
+        Rect<1> range = acc_range[*elem];
+        for (PointInRectIterator<1> b(range); b(); b++) {
+            Point<1> j = acc_col[*b];
+            if (j[0] <= (*elem)[0] || !domain.contains(j)) continue;
+            block_gemv_sub<N_REDOP>(acc_factor.ptr(*b), acc_z.ptr(j), z);
+        }
+        block_lu_solve<N_REDOP>(acc_lu.ptr(*elem), acc_piv.ptr(*elem), z);
+    }
+}
+
+void Preconditioner::register_tasks() {
+    {
+        TaskVariantRegistrar registrar(FACTOR_PRECONDITIONER_TASK_ID,
+            "factor_preconditioner_task");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf();
+        Runtime::preregister_task_variant<factor_preconditioner_task> (registrar,
+            "factor_preconditioner_task");
+    }
+    {
+        TaskVariantRegistrar registrar(APPLY_PRECONDITIONER_TASK_ID, "apply_preconditioner_task");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf();
+        Runtime::preregister_task_variant<apply_preconditioner_task> (registrar,
+            "apply_preconditioner_task");
+    }
+}
+
+Preconditioner::Preconditioner(Context ctx, HighLevelRuntime *runtime, Legion::Logger &logger,
+                               JacobianData &jacobian_data_, const string &type_name) :
+    LegionData(ctx, runtime, logger), jacobian_data(jacobian_data_),
+    type(pc_type_from_name(type_name)) {
+    if (type == N_PC_TYPE) {
+        runtime->print_once(ctx, stderr, ("Unknown preconditioner " + type_name + "\n").c_str());
+        exit(EXIT_FAILURE);
+    }
+    jacobian_data.allocate_elem_field(JacobianData::FID_JAC_PC_LU, N_BLOCK*sizeof(rtype),
+        "jac_pc_lu");
+    jacobian_data.allocate_elem_field(JacobianData::FID_JAC_PC_PIVOT, N_REDOP*sizeof(int),
+        "jac_pc_pivot");
+    if (type == PC_ILU0) {
+        jacobian_data.allocate_block_field(JacobianData::FID_JAC_PC_BLOCK, N_BLOCK*sizeof(rtype),
+            "jac_pc_block");
+    }
+}
+
+void Preconditioner::factor() {
+    PCArgs arg;
+    arg.type = type;
+    IndexLauncher index_launcher(FACTOR_PRECONDITIONER_TASK_ID, jacobian_data.domain,
+        TaskArgument(&arg, sizeof(PCArgs)), ArgumentMap());
+    RegionRequirement req(jacobian_data.elem_lp, 0, READ_ONLY, EXCLUSIVE, jacobian_data.elem_lr);
+    req.add_field(JacobianData::FID_JAC_DIAG);
+    req.add_field(JacobianData::FID_JAC_ROW_RANGE);
+    index_launcher.add_region_requirement(req);
+    req = RegionRequirement(jacobian_data.elem_lp, 0, WRITE_DISCARD, EXCLUSIVE,
+        jacobian_data.elem_lr);
+    req.add_field(JacobianData::FID_JAC_PC_LU);
+    req.add_field(JacobianData::FID_JAC_PC_PIVOT);
+    index_launcher.add_region_requirement(req);
+    if (type == PC_ILU0) {
+        req = RegionRequirement(jacobian_data.block_lp, 0, READ_ONLY, EXCLUSIVE,
+            jacobian_data.block_lr);
+        req.add_field(JacobianData::FID_JAC_BLOCK_COL);
+        req.add_field(JacobianData::FID_JAC_BLOCK_VALUE);
+        index_launcher.add_region_requirement(req);
+        req = RegionRequirement(jacobian_data.block_lp, 0, WRITE_DISCARD, EXCLUSIVE,
+            jacobian_data.block_lr);
+        req.add_field(JacobianData::FID_JAC_PC_BLOCK);
+        index_launcher.add_region_requirement(req);
+    }
+    runtime->execute_index_space(ctx, index_launcher);
+}
+
+void Preconditioner::apply(const SolutionData &solution_data, const FieldID r, const FieldID z) {
+    PCArgs arg;
+    arg.type = type;
+    arg.r = r;
+    arg.z = z;
+    IndexLauncher index_launcher(APPLY_PRECONDITIONER_TASK_ID, jacobian_data.domain,
+        TaskArgument(&arg, sizeof(PCArgs)), ArgumentMap());
+    RegionRequirement req(jacobian_data.elem_lp, 0, READ_ONLY, EXCLUSIVE, jacobian_data.elem_lr);
+    req.add_field(JacobianData::FID_JAC_PC_LU);
+    req.add_field(JacobianData::FID_JAC_PC_PIVOT);
+    if (type == PC_ILU0) req.add_field(JacobianData::FID_JAC_ROW_RANGE);
+    index_launcher.add_region_requirement(req);
+    if (type == PC_ILU0) {
+        req = RegionRequirement(jacobian_data.block_lp, 0, READ_ONLY, EXCLUSIVE,
+            jacobian_data.block_lr);
+        req.add_field(JacobianData::FID_JAC_BLOCK_COL);
+        req.add_field(JacobianData::FID_JAC_PC_BLOCK);
+        index_launcher.add_region_requirement(req);
+    }
+    req = RegionRequirement(solution_data.elem_lp, 0, READ_ONLY, EXCLUSIVE, solution_data.elem_lr);
+    req.add_field(r);
+    index_launcher.add_region_requirement(req);
+    req = RegionRequirement(solution_data.elem_lp, 0, WRITE_DISCARD, EXCLUSIVE,
+        solution_data.elem_lr);
+    req.add_field(z);
+    index_launcher.add_region_requirement(req);
+    runtime->execute_index_space(ctx, index_launcher);
+}
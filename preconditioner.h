@@ -0,0 +1,94 @@
+//
+// Created by kihiro on 6/22/20.
+//
+
+#ifndef DG_PRECONDITIONER_H
+#define DG_PRECONDITIONER_H
+
+#include <string>
+#include "legion.h"
+#include "jacobian_data.h"
+#include "solution_data.h"
+
+/*! \brief Preconditioner types
+ *
+ */
+enum PCType {
+    PC_BLOCK_JACOBI, //!< LU factors of the diagonal blocks
+    PC_ILU0, //!< block ILU(0) of the partition-local sub-matrix (additive Schwarz)
+    N_PC_TYPE, //!< number of types, also returned for unknown names
+};
+
+/*! \brief Preconditioner type from its name in the input file
+ *
+ * @param name "block_jacobi" or "ilu0"
+ * @return type, N_PC_TYPE if the name is unknown
+ */
+inline PCType pc_type_from_name(const std::string &name) {
+    if (name == "block_jacobi") return PC_BLOCK_JACOBI;
+    if (name == "ilu0") return PC_ILU0;
+    return N_PC_TYPE;
+}
+
+/*! \brief Arguments of the preconditioner tasks
+ *
+ */
+struct PCArgs {
+    int type; //!< preconditioner type
+    Legion::FieldID r; //!< input solution field (application only)
+    Legion::FieldID z; //!< output solution field (application only)
+};
+
+/*! \brief Partition-local preconditioner built from the element-block Jacobian
+ *
+ * Every task of the factorization and of the application works on the block rows of one element
+ * partition and ignores the blocks coupling them to other partitions, so neither needs any
+ * communication. The factors are stored in fields of the Jacobian regions:
+ * - block-Jacobi factors every diagonal block with a dense LU;
+ * - ILU(0) factors the partition-local sub-matrix in element order without fill-in: the diagonal
+ *   blocks hold the LU factors of the pivots and the off-diagonal blocks the incomplete L (below
+ *   the diagonal) and U (above) factors.
+ * The dense kernels are templates specialized on N_REDOP.
+ */
+class Preconditioner : public LegionData {
+  public:
+    /*! \brief Pre-register all preconditioner related tasks
+     *
+     */
+    static void register_tasks();
+
+    /*! \brief Constructor
+     *
+     * Allocate the factor fields.
+     *
+     * @param ctx Legion's context
+     * @param runtime Legion's runtime
+     * @param logger
+     * @param jacobian_data Jacobian regions holding the factors
+     * @param type "block_jacobi" or "ilu0", exits on any other name
+     */
+    Preconditioner(Legion::Context ctx, Legion::HighLevelRuntime *runtime, Legion::Logger &logger,
+                   JacobianData &jacobian_data, const std::string &type);
+
+    /*! \brief Factor the assembled Jacobian
+     *
+     * Does not block.
+     */
+    void factor();
+
+    /*! \brief z = M^-1 r on solution fields
+     *
+     * Does not block.
+     *
+     * @param solution_data solution regions holding both fields
+     * @param r input field
+     * @param z output field, different from r
+     */
+    void apply(const SolutionData &solution_data, const Legion::FieldID r, const Legion::FieldID z);
+
+  private:
+    JacobianData &jacobian_data; //!< Jacobian regions
+    PCType type; //!< preconditioner type
+};
+
+#endif //DG_PRECONDITIONER_H
@@ -6,12 +6,77 @@
 #define DG_REDOP_H
 
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <iterator>
 #include "legion.h"
 
 using namespace Legion;
 
-template <int n>
+#ifdef REPRODUCIBLE
+// number of fractional bits of the fixed-point grid of the reproducible sums, values must stay
+// below 2^(51 - REPRODUCIBLE_FRACTION_BITS) in magnitude and contributions below
+// 2^-(REPRODUCIBLE_FRACTION_BITS + 1) are lost
+#ifndef REPRODUCIBLE_FRACTION_BITS
+#define REPRODUCIBLE_FRACTION_BITS 32
+#endif
+
+/*! \brief Round to the nearest multiple of 2^-REPRODUCIBLE_FRACTION_BITS
+ *
+ * Adding and subtracting 1.5*2^(52 - REPRODUCIBLE_FRACTION_BITS) leaves exactly the bits above
+ * the grid under round-to-nearest. Branch-free, so loops over it vectorize. Sums of values on the
+ * grid are exact as long as they stay in range, hence associative: the reductions then give the
+ * same bits whatever the order Legion applies and folds them in.
+ */
+inline rtype quantize(const rtype x) {
+    const rtype magic = 1.5*std::ldexp(1., 52 - REPRODUCIBLE_FRACTION_BITS);
+    return (x + magic) - magic;
+}
+
+/*! \brief quantize, recording whether x was in range
+ *
+ * From 2^(51 - REPRODUCIBLE_FRACTION_BITS) on, x + magic leaves the binade of magic and is rounded
+ * to a coarser grid, on which sums are no longer exact. The bits in which x + magic differs from
+ * magic are or-ed into flags: any of them in the sign or exponent field (see quantize_in_range)
+ * means that x was out of range, or not a number. Integer or-ing keeps the loops vectorized.
+ */
+inline rtype quantize_checked(const rtype x, uint64_t &flags) {
+    union { rtype as_float; uint64_t as_int; } magic, shifted;
+    magic.as_float = 1.5*std::ldexp(1., 52 - REPRODUCIBLE_FRACTION_BITS);
+    shifted.as_float = x + magic.as_float;
+    flags |= shifted.as_int ^ magic.as_int;
+    return shifted.as_float - magic.as_float;
+}
+
+/*! \brief Whether all the values whose flags were collected by quantize_checked were in range
+ *
+ */
+inline bool quantize_in_range(const uint64_t flags) {
+    return (flags >> 52) == 0;
+}
+
+/*! \brief Abort on a value out of the range of the fixed-point grid
+ *
+ * The reduction instances only hold one double per value, there is no room to fall back to a
+ * wider accumulator: a reproducible run that overflows the grid cannot continue.
+ */
+inline void quantize_range_error() {
+    fprintf(stderr, "Reproducible sum out of range (|x| >= 2^%d) or not a number, lower "
+        "REPRODUCIBLE_FRACTION_BITS\n", 51 - REPRODUCIBLE_FRACTION_BITS);
+    abort();
+}
+#endif
+
+/*! \brief Sum of arrays of n values
+ *
+ * The values are stored (and exchanged between instances) as storage_t and added in rtype, each
+ * apply rounding its result back to storage_t. With the single precision residual fields of mixed
+ * precision builds, the face tasks therefore sum their contributions per element in rtype first
+ * (see ElemAccumulator in solution_data.cpp) and apply each element once per launch.
+ */
+template <int n, typename storage_t = rtype>
 class ReductionSum {
   public:
     typedef struct LHS {
@@ -29,39 +94,189 @@ class ReductionSum {
             return *this;
         }
 
-        rtype value[n];
+        storage_t value[n];
     } LHS;
 
     typedef LHS RHS;
 
     static const LHS identity;
 
+#ifdef REPRODUCIBLE
+    // both operands are snapped to the grid, so that values written without reduction (the volume
+    // term for instance) join the grid at their first reduction. Their range is checked once per
+    // array, which keeps the exclusive loop branch-free
+    template<bool EXCLUSIVE>
+    void static apply(LHS &lhs, RHS rhs) {
+        static_assert(sizeof(storage_t) == sizeof(uint64_t), "REPRODUCIBLE needs double storage");
+        uint64_t flags = 0;
+        if (EXCLUSIVE) {
+            for (auto i = 0; i < n; ++i) {
+                lhs.value[i] = quantize_checked(lhs.value[i], flags)
+                    + quantize_checked(rhs.value[i], flags);
+            }
+            if (!quantize_in_range(flags)) quantize_range_error();
+            return;
+        }
+        for (auto i = 0; i < n; ++i) {
+            volatile uint64_t *target = (volatile uint64_t *) &lhs.value[i];
+            rtype q = quantize_checked(rhs.value[i], flags);
+            union { uint64_t as_int; rtype as_float; } oldval, newval;
+            do {
+                oldval.as_int = *target;
+                newval.as_float = quantize(oldval.as_float) + q;
+            } while (!__sync_bool_compare_and_swap(target, oldval.as_int, newval.as_int));
+            quantize_checked(oldval.as_float, flags);
+        }
+        if (!quantize_in_range(flags)) quantize_range_error();
+    }
+
+    template<bool EXCLUSIVE>
+    void static fold(RHS &rhs1, RHS rhs2) {
+        apply<EXCLUSIVE>(rhs1, rhs2);
+    }
+#else
     template<bool EXCLUSIVE>
     void static apply(LHS &lhs, RHS rhs) {
         for (auto i = 0; i < n; ++i) {
-            SumReduction<rtype>::apply<EXCLUSIVE>(lhs.value[i], rhs.value[i]);
+            if (EXCLUSIVE) lhs.value[i] = (rtype) lhs.value[i] + (rtype) rhs.value[i];
+            else SumReduction<storage_t>::template apply<false>(lhs.value[i], rhs.value[i]);
         }
     }
 
     template<bool EXCLUSIVE>
     void static fold(RHS &rhs1, RHS rhs2) {
         for (auto i = 0; i < n; ++i) {
-            SumReduction<rtype>::fold<EXCLUSIVE>(rhs1.value[i], rhs2.value[i]);
+            if (EXCLUSIVE) rhs1.value[i] = (rtype) rhs1.value[i] + (rtype) rhs2.value[i];
+            else SumReduction<storage_t>::template fold<false>(rhs1.value[i], rhs2.value[i]);
+        }
+    }
+#endif
+};
+
+template<int n, typename storage_t>
+const typename ReductionSum<n, storage_t>::LHS ReductionSum<n, storage_t>::identity =
+    ReductionSum<n, storage_t>::LHS();
+
+/*! \brief Exact accumulator of doubles
+ *
+ * Integer bins of 32 bits covering the whole double range (binned superaccumulator). Every double
+ * is an integer times 2^(bin 0), so it is split over three consecutive bins and added exactly.
+ * Integer sums are associative, so the result does not depend on the order of the additions; once
+ * normalized (carries propagated) the bins are unique and so is the conversion back to a double.
+ * The bins leave 31 bits of headroom: normalize at least every 2^30 additions.
+ */
+struct SuperAccumulator {
+    static const int NBIN = 70; //!< number of bins
+    static const int BIN_BITS = 32; //!< bits per bin
+    static const int OFFSET = 1126; //!< -log2 of the weight of bin 0 (subnormal ulp is 2^-1074)
+
+    SuperAccumulator() {
+        for (int k=0; k<NBIN; k++) bin[k] = 0;
+    }
+
+    /*! \brief Add a double exactly
+     *
+     */
+    void add(const double x) {
+        if (x == 0.) return;
+        int e;
+        double m = std::frexp(x, &e);
+        // x = mantissa*2^(e - 53) with an integer mantissa of at most 53 bits
+        int64_t mantissa = (int64_t) std::ldexp(m, 53);
+        int shift = e - 53 + OFFSET;
+        int k = shift/BIN_BITS;
+        unsigned __int128 v = (unsigned __int128) (mantissa < 0 ? -mantissa : mantissa)
+            << (shift%BIN_BITS);
+        for (int j=0; j<3; j++, v >>= BIN_BITS) {
+            int64_t chunk = (int64_t) (v & 0xffffffffu);
+            bin[k + j] += mantissa < 0 ? -chunk : chunk;
+        }
+    }
+
+    /*! \brief Propagate the carries, every bin but the last one ends up in [0, 2^32)
+     *
+     */
+    void normalize() {
+        for (int k=0; k<NBIN-1; k++) {
+            int64_t carry = bin[k] >> BIN_BITS;
+            bin[k] -= carry*((int64_t) 1 << BIN_BITS);
+            bin[k+1] += carry;
+        }
+    }
+
+    /*! \brief Value rounded to a double, requires normalized bins
+     *
+     */
+    double value() const {
+        // negative sums are normalized into two's complement over all the bins, convert the
+        // magnitude instead so that the leading bins are empty
+        SuperAccumulator magnitude = *this;
+        double sign = bin[NBIN-1] < 0 ? -1. : 1.;
+        if (sign < 0.) {
+            for (int k=0; k<NBIN; k++) magnitude.bin[k] = -bin[k];
+            magnitude.normalize();
+        }
+        double result = 0.;
+        for (int k=NBIN-1; k>=0; k--) {
+            if (magnitude.bin[k] == 0) continue;
+            result += std::ldexp((double) magnitude.bin[k], k*BIN_BITS - OFFSET);
+        }
+        return sign*result;
+    }
+
+    int64_t bin[NBIN]; //!< bins, bin k weighs 2^(32k - OFFSET)
+};
+
+/*! \brief Reduction of superaccumulators, for reproducible global sums
+ *
+ */
+class ReductionSuperSum {
+  public:
+    typedef SuperAccumulator LHS;
+    typedef SuperAccumulator RHS;
+
+    static const SuperAccumulator identity;
+
+    template<bool EXCLUSIVE>
+    void static apply(LHS &lhs, RHS rhs) {
+        for (int k=0; k<SuperAccumulator::NBIN; k++) {
+            if (EXCLUSIVE) lhs.bin[k] += rhs.bin[k];
+            else __sync_fetch_and_add(&lhs.bin[k], rhs.bin[k]);
         }
+        if (EXCLUSIVE) lhs.normalize();
+    }
+
+    template<bool EXCLUSIVE>
+    void static fold(RHS &rhs1, RHS rhs2) {
+        apply<EXCLUSIVE>(rhs1, rhs2);
     }
 };
 
-template<int n>
-const typename ReductionSum<n>::LHS ReductionSum<n>::identity = ReductionSum<n>::LHS();
-
-// N_REDOP = ns*nb
-// #define N_REDOP 4  // quad, p=0
-// #define N_REDOP 16 // quad, p=1
-#define N_REDOP 36 // quad, p=2
-// #define N_REDOP 64 // quad, p=3
-//#define N_REDOP 5 // hex, p = 0
-//#define N_REDOP 40 // hex, p = 1
-//#define N_REDOP 135// hex, p = 2
-//#define N_REDOP 320 // hex, p = 3
+// N_REDOP = ns*nb is the number of values per element, N_TRACE = ns*nb_face the size of the
+// trace of an element on one of its faces, with nb = (p+1)^dim and nb_face = (p+1)^(dim-1).
+// Presets:
+// quad: N_DIM 2, N_STATE 4, p = 0..3 gives N_REDOP = 4, 16, 36, 64 and N_TRACE = 4, 8, 12, 16
+// hex:  N_DIM 3, N_STATE 5, p = 0..3 gives N_REDOP = 5, 40, 135, 320 and N_TRACE = 5, 20, 45, 80
+#define N_DIM 2 // number of spatial dimensions
+#define N_STATE 4 // number of states
+#define N_ORDER 2 // polynomial order
+
+// number of basis functions of an element and of a face for order p
+#define N_BASIS(p) (N_DIM==3 ? ((p)+1)*((p)+1)*((p)+1) : ((p)+1)*((p)+1))
+#define N_BASIS_FACE(p) (N_DIM==3 ? ((p)+1)*((p)+1) : ((p)+1))
+
+// number of values per element for order p, the lower orders are the p-multigrid levels
+#define N_REDOP_P(p) (N_STATE*N_BASIS(p))
+#define N_REDOP N_REDOP_P(N_ORDER)
+#define N_TRACE (N_STATE*N_BASIS_FACE(N_ORDER))
+
+// N_BLOCK = N_REDOP*N_REDOP, size of one element block of the Jacobian (stored row after row)
+#define N_BLOCK (N_REDOP*N_REDOP)
+
+// reduction operator IDs, registered in main
+#define REDOP_SUM_ID 1 // ReductionSum<N_REDOP, stype> of the residual fields
+#define REDOP_BLOCK_SUM_ID 2 // ReductionSum<N_BLOCK>
+#define REDOP_SUPER_SUM_ID 3 // ReductionSuperSum (REPRODUCIBLE builds)
+#define REDOP_MG_SUM_ID 10 // ReductionSum<N_REDOP_P(p)> of the p-multigrid level p, ID + p
 
 #endif //DG_REDOP_H
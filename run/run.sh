@@ -6,8 +6,6 @@ EXEC="../exec"
 #export LEGION_FREEZE_ON_ERROR=1
 
 FLAGS="$FLAGS -lg:no_tracing"
-FLAGS="$FLAGS -lg:inorder"
-FLAGS="$FLAGS -lg:partcheck"
 
 NCPU_PER_RANK=4
 NRANK=8
@@ -0,0 +1,58 @@
+//
+// Created by kihiro on 5/4/20.
+//
+
+#include <cstring>
+#include "shm_reader.h"
+
+using namespace std;
+
+ShmReader::ShmReader(const string &prefix, const int partition) :
+    name(ShmSegment::name(prefix, partition)) {}
+
+bool ShmReader::read(ShmSnapshot &snapshot, const int max_retries) {
+    for (int attempt=0; attempt<max_retries; attempt++) {
+        if (!segment || !segment->valid()) {
+            segment.reset(new ShmSegment(name));
+            if (!segment->valid()) return false;
+        }
+        const ShmHeader *header = segment->header();
+        uint64_t seq0 = header->sequence.load(memory_order_acquire);
+        if (seq0 % 2 == 1) continue; // update in progress
+
+        int nElem = header->nElem;
+        int nValue = header->nValue;
+        int value_size = header->value_size;
+        if (nElem < 0 || nValue < 0 || (value_size != sizeof(double) &&
+            value_size != sizeof(float))) continue; // header read during an update
+        if (ShmSegment::size(nElem, nValue, value_size) > segment->mapped_size()) {
+            // the segment grew since it was mapped
+            segment.reset();
+            continue;
+        }
+        snapshot.iteration = header->iteration;
+        snapshot.partition = header->partition;
+        snapshot.nValue = nValue;
+        snapshot.elem_lo = header->elem_lo;
+        snapshot.elem_hi = header->elem_hi;
+        snapshot.elem_ids.assign(segment->elem_ids(), segment->elem_ids() + nElem);
+        snapshot.values.resize((size_t) nElem*nValue);
+        const char *values = segment->values(nElem);
+        for (size_t i=0; i<snapshot.values.size(); i++) {
+            if (value_size == sizeof(double)) {
+                double v;
+                memcpy(&v, values + i*value_size, sizeof(double));
+                snapshot.values[i] = v;
+            }
+            else {
+                float v;
+                memcpy(&v, values + i*value_size, sizeof(float));
+                snapshot.values[i] = v;
+            }
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+        if (header->sequence.load(memory_order_relaxed) == seq0) return true;
+    }
+    return false;
+}
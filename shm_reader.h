@@ -0,0 +1,53 @@
+//
+// Created by kihiro on 5/4/20.
+//
+
+#ifndef DG_SHM_READER_H
+#define DG_SHM_READER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "shm_segment.h"
+
+/*! \brief Consistent copy of the data published by one partition
+ *
+ */
+struct ShmSnapshot {
+    int iteration; //!< iteration of the data
+    int partition; //!< partition ID
+    int nValue; //!< number of values per element
+    int64_t elem_lo; //!< smallest element ID of the partition
+    int64_t elem_hi; //!< largest element ID of the partition
+    std::vector<int64_t> elem_ids; //!< global element IDs
+    std::vector<double> values; //!< nValue values per element, element after element
+};
+
+/*! \brief Reader of the residual published in shared memory by the solver
+ *
+ * Readers never block the solver: a read is retried when it overlaps with an update.
+ */
+class ShmReader {
+  public:
+    /*! \brief Constructor
+     *
+     * @param prefix prefix of the segment names, as given to the solver
+     * @param partition partition to read
+     */
+    ShmReader(const std::string &prefix, const int partition);
+
+    /*! \brief Copy the latest consistent data
+     *
+     * @param snapshot receives the data
+     * @param max_retries number of attempts before giving up
+     * @return true on success, false if the segment does not exist or kept changing
+     */
+    bool read(ShmSnapshot &snapshot, const int max_retries = 1000);
+
+  private:
+    std::string name; //!< segment name
+    std::unique_ptr<ShmSegment> segment; //!< mapped segment, reopened if it grew
+};
+
+#endif //DG_SHM_READER_H
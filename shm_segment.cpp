@@ -0,0 +1,74 @@
+//
+// Created by kihiro on 5/4/20.
+//
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sstream>
+#include "shm_segment.h"
+
+using namespace std;
+
+string ShmSegment::name(const string &prefix, const int partition) {
+    stringstream ss;
+    ss << "/" << prefix << "_" << partition;
+    return ss.str();
+}
+
+size_t ShmSegment::size(const int nElem, const int nValue, const int value_size) {
+    return sizeof(ShmHeader) + nElem*sizeof(int64_t) + (size_t) nElem*nValue*value_size;
+}
+
+void ShmSegment::unlink(const string &name) {
+    shm_unlink(name.c_str());
+}
+
+ShmSegment::ShmSegment(const string &name, const size_t size) : addr(NULL), length(0) {
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0) return;
+    // a new segment is zero-filled, which is a valid sequence number; a segment is never shrunk
+    // since readers may have mapped it whole
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && ((size_t) st.st_size >= size || ftruncate(fd, size) == 0);
+    if (ok) {
+        void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (ptr != MAP_FAILED) {
+            addr = ptr;
+            length = size;
+        }
+    }
+    close(fd);
+}
+
+ShmSegment::ShmSegment(const string &name) : addr(NULL), length(0) {
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(ShmHeader)) {
+        void *ptr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (ptr != MAP_FAILED) {
+            addr = ptr;
+            length = st.st_size;
+        }
+    }
+    close(fd);
+}
+
+ShmSegment::~ShmSegment() {
+    if (addr != NULL) munmap(addr, length);
+}
+
+void ShmSegment::begin_write() {
+    uint64_t seq = header()->sequence.load(memory_order_relaxed);
+    if (seq % 2 == 1) seq++; // a previous writer was interrupted
+    header()->sequence.store(seq + 1, memory_order_relaxed);
+    // the odd sequence number must be visible before any data is modified
+    atomic_thread_fence(memory_order_release);
+}
+
+void ShmSegment::end_write() {
+    uint64_t seq = header()->sequence.load(memory_order_relaxed);
+    header()->sequence.store(seq + 1, memory_order_release);
+}
@@ -0,0 +1,109 @@
+//
+// Created by kihiro on 5/4/20.
+//
+
+#ifndef DG_SHM_SEGMENT_H
+#define DG_SHM_SEGMENT_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*! \brief Header of a shared-memory segment holding the residual of one partition
+ *
+ * The header is followed by the global IDs of the elements of the partition (int64_t) and by their
+ * values (nValue values of value_size bytes per element, element after element). The sequence
+ * number is odd while the writer updates the segment (seqlock).
+ */
+struct ShmHeader {
+    std::atomic<uint64_t> sequence; //!< seqlock sequence number
+    int32_t iteration; //!< iteration of the published data
+    int32_t partition; //!< partition ID
+    int32_t nElem; //!< number of elements in the partition
+    int32_t nValue; //!< number of values per element
+    int32_t value_size; //!< size of a value in bytes
+    int32_t padding; //!< keeps the element IDs 8-byte aligned
+    int64_t elem_lo; //!< smallest element ID of the partition
+    int64_t elem_hi; //!< largest element ID of the partition
+};
+
+/*! \brief POSIX shared-memory segment mapped in memory
+ *
+ */
+class ShmSegment {
+  public:
+    /*! \brief Name of the segment of a partition
+     *
+     * @param prefix prefix of the segment names
+     * @param partition partition ID
+     * @return segment name
+     */
+    static std::string name(const std::string &prefix, const int partition);
+
+    /*! \brief Size of a segment
+     *
+     * @param nElem number of elements
+     * @param nValue number of values per element
+     * @param value_size size of a value in bytes
+     * @return size in bytes
+     */
+    static size_t size(const int nElem, const int nValue, const int value_size);
+
+    /*! \brief Remove the name of a segment
+     *
+     * Mapped segments stay valid until they are unmapped, a missing segment is ignored.
+     *
+     * @param name segment name
+     */
+    static void unlink(const std::string &name);
+
+    /*! \brief Create (or resize) a segment for writing
+     *
+     * @param name segment name
+     * @param size segment size in bytes
+     */
+    ShmSegment(const std::string &name, const size_t size);
+
+    /*! \brief Open an existing segment for reading
+     *
+     * @param name segment name
+     */
+    explicit ShmSegment(const std::string &name);
+
+    ShmSegment(const ShmSegment &) = delete;
+    ShmSegment &operator=(const ShmSegment &) = delete;
+
+    ~ShmSegment();
+
+    bool valid() const { return addr != NULL; }
+    size_t mapped_size() const { return length; }
+    ShmHeader *header() const { return (ShmHeader *) addr; }
+    int64_t *elem_ids() const { return (int64_t *) ((char *) addr + sizeof(ShmHeader)); }
+    /*! \brief Values following the element IDs
+     *
+     * The number of elements is passed rather than read from the header, which a writer may modify
+     * while a reader uses the segment.
+     *
+     * @param nElem number of elements, validated against mapped_size()
+     */
+    char *values(const int nElem) const {
+        return (char *) elem_ids() + (size_t) nElem * sizeof(int64_t);
+    }
+
+    /*! \brief Mark the segment as being written
+     *
+     */
+    void begin_write();
+
+    /*! \brief Mark the segment as consistent again
+     *
+     */
+    void end_write();
+
+  private:
+    void *addr; //!< mapped address
+    size_t length; //!< mapped size
+};
+
+#endif //DG_SHM_SEGMENT_H
@@ -5,7 +5,11 @@
 #ifndef DG_SOLUTION_DATA_H
 #define DG_SOLUTION_DATA_H
 
+#include <string>
+#include <vector>
 #include "legion.h"
+#include "legion_handle.h"
+#include "geometry_data.h"
 #include "mesh_data.h"
 
 struct Args {
@@ -13,6 +17,50 @@ struct Args {
     int nIter;
 };
 
+/*! \brief Arguments of the shared-memory export and unlink tasks
+ *
+ */
+struct ShmArgs {
+    int iteration; //!< iteration being published
+    char prefix[64]; //!< prefix of the segment names
+};
+
+/*! \brief Arguments of the trace tasks
+ *
+ */
+struct TraceArgs {
+    int nIter; //!< total number of iterations
+    int dim; //!< number of spatial dimensions
+    int nq1d; //!< number of face quadrature points per direction
+};
+
+/*! \brief Maximum number of ensemble members
+ *
+ */
+#define MAX_ENSEMBLE 64
+
+/*! \brief Arguments of the face residual tasks
+ *
+ * The face kernels visit each face once and reduce into every ensemble member, member m receiving
+ * the flux scaled by scale[m].
+ */
+struct FaceArgs {
+    int nIter; //!< total number of iterations
+    int nMember; //!< number of ensemble members
+    int dim; //!< number of spatial dimensions
+    int nq1d; //!< number of face quadrature points per direction (interior faces)
+    rtype scale[MAX_ENSEMBLE]; //!< parameter of each member
+};
+
+/*! \brief Arguments of the volume residual task
+ *
+ */
+struct VolumeArgs {
+    int nIter; //!< total number of iterations
+    int dim; //!< number of spatial dimensions
+    int nq1d; //!< number of quadrature points per direction
+};
+
 /*! \brief Class to hold solution related regions
  *
  */
@@ -24,6 +72,28 @@ class SolutionData : public LegionData {
     enum FieldIDs {
         FID_SOL_RESIDUAL, //!< storage for residual
         FID_SOL_REFERENCE,
+        FID_SOL_FACE_RESIDUAL, //!< face contributions awaiting accumulate_face_residual
+        FID_SOL_STATE, //!< solution state advanced by the time integrator
+        FID_SOL_REGISTER, //!< time integration register (state or stage derivative)
+        FID_SOL_NEWTON_UN, //!< state at the previous time level (implicit solver)
+        FID_SOL_NEWTON_R0, //!< residual at the current Newton iterate (implicit solver)
+        FID_SOL_NEWTON_SAVE, //!< state saved around perturbed evaluations (implicit solver)
+        FID_SOL_PRECONDITIONED, //!< preconditioned Krylov vector (implicit solver)
+        FID_SOL_KRYLOV = 100, //!< first of the consecutive Krylov basis fields (implicit solver)
+        FID_SOL_MG = 200, //!< first of the p-multigrid fields, four per order (see PMultigrid)
+        FID_SOL_ENSEMBLE = 300, //!< residual of ensemble member m at FID_SOL_ENSEMBLE + m, m >= 1
+    };
+
+    /*! \brief Trace region's fields
+     *
+     * Traces are N_TRACE values per face: the ns states at the element nodes lying on the face.
+     * State traces are rtype like FID_SOL_STATE, face residuals stype like the residual.
+     */
+    enum TraceFieldIDs {
+        FID_TRACE_L, //!< trace of the left element
+        FID_TRACE_R, //!< trace of the right element
+        FID_TRACE_RESIDUAL_L, //!< face residual to lift into the left element
+        FID_TRACE_RESIDUAL_R, //!< face residual to lift into the right element
     };
 
     /*! \brief Pre-register all solution related tasks
@@ -31,6 +101,15 @@ class SolutionData : public LegionData {
      */
     static void register_tasks();
 
+    /*! \brief Whether a field holds residual values, stored as stype
+     *
+     * The residual, its reference, its face accumulation, the ensemble members and the residual
+     * saved by the implicit solver. Every other field is stored as rtype.
+     *
+     * @param fid field ID
+     */
+    static bool is_residual_field(const Legion::FieldID fid);
+
     /*! \brief Constructor
      *
      * @param ctx Legion's context
@@ -39,8 +118,17 @@ class SolutionData : public LegionData {
      */
     SolutionData(Legion::Context ctx, Legion::HighLevelRuntime *runtime, Legion::Logger &logger_);
 
+    /*! \brief Destructor
+     *
+     * Release the Legion ressources that are still owned.
+     */
+    ~SolutionData();
+
     /*! \brief Clean up Legion's ressources used for solution related regions
      *
+     * Called by the destructor as well. Calling it explicitly releases the ressources earlier. The
+     * partitions belong to the mesh data and are left untouched. A pending checkpoint is completed
+     * and the published shared-memory segments are removed.
      */
     void clean_up();
 
@@ -53,20 +141,309 @@ class SolutionData : public LegionData {
      */
     void create_solution_region(const MeshData &mesh_data);
 
+    /*! \brief Zero the residual and reference fields
+     *
+     * The face accumulation field, the state and the residuals of the ensemble members are zeroed
+     * as well when they are in use.
+     */
     void zero_field();
 
-    void compute_iface_residual(const int nIter, const MeshData &mesh_data);
+    /*! \brief Accumulate the interior face contribution into the residual
+     *
+     * The toy flux is weighted by an integral over the face of the precomputed normals and
+     * surface Jacobians. It only reaches the element nodes lying on each face, so that
+     * compute_iface_residual_trace gives the same contributions.
+     *
+     * @param nIter total number of iterations
+     * @param mesh_data mesh regions
+     * @param geometry_data face metrics
+     * @param pred predicate guarding the launch, the launch is skipped when it resolves to false
+     */
+    void compute_iface_residual(const int nIter, const MeshData &mesh_data,
+        const GeometryData &geometry_data,
+        const Legion::Predicate &pred = Legion::Predicate::TRUE_PRED);
+
+    /*! \brief Copy a solution field into another one
+     *
+     * The copy is issued as an index copy over the element partition so that it is carried out
+     * asynchronously by the DMA system instead of occupying a processor. Both fields must have the
+     * same size.
+     *
+     * @param src_fid source field
+     * @param dst_fid destination field
+     */
+    void copy_field(const Legion::FieldID src_fid, const Legion::FieldID dst_fid);
+
+    /*! \brief Fill every entry of a field with a value
+     *
+     * Issued as an index fill over the element partition, no task involved.
+     *
+     * @param fid field to fill
+     * @param value value of every entry
+     * @param pred predicate guarding the fill
+     */
+    void fill_field(const Legion::FieldID fid, const rtype value,
+        const Legion::Predicate &pred = Legion::Predicate::TRUE_PRED);
+
+    /*! \brief Allocate an additional N_REDOP wide field in the solution field space
+     *
+     * For solvers needing work fields only when they are enabled. Does nothing if the field
+     * already exists. Residual fields (see is_residual_field) hold stype values, the others rtype.
+     *
+     * @param fid field ID
+     * @param name field name
+     */
+    void allocate_field(const Legion::FieldID fid, const std::string &name);
+
+    /*! \brief Allocate an additional field of a given size in the solution field space
+     *
+     * @param fid field ID
+     * @param name field name
+     * @param size size of one element's entry in bytes
+     */
+    void allocate_field(const Legion::FieldID fid, const std::string &name, const size_t size);
+
+    /*! \brief Whether a field is allocated in the solution field space
+     *
+     */
+    bool has_field(const Legion::FieldID fid) const;
+
+    /*! \brief Make the face launches reduce into FID_SOL_FACE_RESIDUAL
+     *
+     * The volume launch then owns FID_SOL_RESIDUAL. The two sets of launches touch different
+     * fields, so Legion runs the element-local volume work while the cut-face reductions are in
+     * flight. accumulate_face_residual merges the two afterwards. The field is allocated and
+     * zeroed here.
+     */
+    void use_face_accumulation_field();
 
+    /*! \brief Allocate and zero the solution state FID_SOL_STATE, if not done yet
+     *
+     * Called by the solvers advancing the state and by the trace exchange, which interpolates it.
+     */
+    void use_state();
+
+    /*! \brief Run an ensemble of cases sharing the mesh and its partitioning
+     *
+     * Member 0 is the regular residual, members 1 to nMember-1 get their own residual field,
+     * zeroed here. The interior and boundary face launches then carry all the members: each face
+     * is visited once and its connectivity loaded once for the whole ensemble. The volume term,
+     * the face traces and the time integrators do not handle the members, main rejects ensembles
+     * combined with them.
+     *
+     * @param scales parameter of each member, at most MAX_ENSEMBLE of them
+     */
+    void use_ensemble(const std::vector<rtype> &scales);
+
+    /*! \brief Residual field of an ensemble member
+     *
+     * @param member member index
+     * @return field receiving the face contributions of the member
+     */
+    Legion::FieldID member_fid(const int member) const;
+
+    /*! \brief Add the volume contribution to the residual
+     *
+     * Runs on the disjoint element partition, no halo involved.
+     *
+     * @param nIter total number of iterations
+     * @param geometry_data geometric factors
+     * @param pred predicate guarding the launch
+     */
+    void compute_volume_residual(const int nIter, const GeometryData &geometry_data,
+        const Legion::Predicate &pred = Legion::Predicate::TRUE_PRED);
+
+    /*! \brief Add the face accumulation field to the residual and reset it
+     *
+     * Does nothing unless use_face_accumulation_field was called.
+     *
+     * @param pred predicate guarding the launch
+     */
+    void accumulate_face_residual(const Legion::Predicate &pred = Legion::Predicate::TRUE_PRED);
+
+    /*! \brief Set the boundary condition type of each boundary face group
+     *
+     * Groups left without a type are walls. Exits on an unknown name.
+     *
+     * @param names type names ("wall", "inflow" or "outflow"), in the order of the group names
+     */
+    void set_boundary_types(const std::vector<std::string> &names);
+
+    /*! \brief Accumulate the boundary face contribution into the residual
+     *
+     * One index launch per boundary face group over its partition, each using the kernel of the
+     * group's boundary condition type (wall for groups without a type). The boundary faces of a
+     * partition only touch its own elements, so no halo is involved.
+     *
+     * @param nIter total number of iterations
+     * @param mesh_data mesh regions
+     * @param pred predicate guarding the launches
+     */
+    void compute_bface_residual(const int nIter, const MeshData &mesh_data,
+        const Legion::Predicate &pred = Legion::Predicate::TRUE_PRED);
+
+    /*! \brief Create the face trace region
+     *
+     * Only needed by compute_iface_residual_trace. The region shares the index space and the
+     * partitions of the mesh interior face region. Traces are extracted without applying the face
+     * orientation, so the mesh must have aligned faces (see Mesh::aligned_faces()). The traces
+     * are the ones of the state, which is allocated here (see use_state()).
+     *
+     * @param mesh_data mesh regions
+     */
+    void create_trace_region(const MeshData &mesh_data);
+
+    /*! \brief Accumulate the interior face contribution into the residual through face traces
+     *
+     * Alternative to compute_iface_residual that never accesses halo elements. Each partition
+     * interpolates its elements onto the traces of their faces, the face kernel runs on the traces
+     * and each partition lifts the face residuals back into its own elements. Only N_TRACE values
+     * per face cross partition boundaries instead of N_REDOP values per halo element.
+     *
+     * @param nIter total number of iterations
+     * @param mesh_data mesh regions
+     * @param geometry_data face metrics
+     * @param pred predicate guarding the launches
+     */
+    void compute_iface_residual_trace(const int nIter, const MeshData &mesh_data,
+        const GeometryData &geometry_data,
+        const Legion::Predicate &pred = Legion::Predicate::TRUE_PRED);
+
+    /*! \brief Save a field into a snapshot field
+     *
+     * @param fid field to save
+     * @param snapshot_fid field receiving the snapshot
+     */
+    void snapshot(const Legion::FieldID fid, const Legion::FieldID snapshot_fid);
+
+    /*! \brief Restore a field from a snapshot field
+     *
+     * @param fid field to restore
+     * @param snapshot_fid field holding the snapshot
+     */
+    void restore(const Legion::FieldID fid, const Legion::FieldID snapshot_fid);
+
+    /*! \brief Snapshot the residual into the reference field
+     *
+     */
     void copy_to_reference();
 
-    void check(const int iteration, const int nIter);
+    /*! \brief Check that the residual grew linearly since the reference snapshot
+     *
+     * The residual after iteration i must be i+1 times the reference taken after iteration 0, up
+     * to rounding. Only holds for plain residual evaluations. Does not block, so the check runs
+     * alongside the following iterations.
+     *
+     * @param iteration current iteration
+     * @param nIter total number of iterations
+     * @return future holding the number of residual entries failing the check
+     */
+    Legion::Future check(const int iteration, const int nIter);
 
-    rtype compute_error() const;
+    /*! \brief Sum of the residual entries
+     *
+     * Blocks until the sum is available. In REPRODUCIBLE builds the sum is exact before the final
+     * rounding, so it does not depend on the partitioning nor on the reduction order.
+     *
+     * @param fid residual field, the one of an ensemble member for instance
+     * @return sum of the residual entries
+     */
+    rtype compute_error(const Legion::FieldID fid = FID_SOL_RESIDUAL) const;
+
+    /*! \brief Non-blocking version of compute_error
+     *
+     * @param fid residual field
+     * @return future holding the sum of the residual entries, as a SuperAccumulator in
+     * REPRODUCIBLE builds
+     */
+    Legion::Future compute_error_async(const Legion::FieldID fid = FID_SOL_RESIDUAL) const;
+
+    /*! \brief Squared L2 norm of the residual
+     *
+     * Does not block. The partial sums of each partition are reduced into a single future that can
+     * be handed over to a ConvergenceMonitor.
+     *
+     * @return future holding the squared L2 norm of the residual
+     */
+    Legion::Future compute_residual_norm() const;
 
-    Legion::LogicalRegion elem_lr; //!< element logical region
+    /*! \brief Write the solution fields to an HDF5 checkpoint file
+     *
+     * The file holds one dataset per field indexed by global element ID, the residuals of the
+     * ensemble members included. It is attached to a temporary region into which every partition
+     * is copied, so the write proceeds asynchronously to the following iterations. Only the file
+     * creation and the completion of the previous checkpoint are waited on. Requires Legion to be
+     * built with HDF5 support.
+     *
+     * The data goes to <file_name>.tmp, renamed into file_name once complete by the next
+     * checkpoint, restart or clean_up, so that an interrupted write never destroys the previous
+     * checkpoint.
+     *
+     * @param file_name checkpoint file, replaced
+     * @param iteration last iteration included in the checkpoint
+     */
+    void checkpoint(const std::string &file_name, const int iteration);
+
+    /*! \brief Read the solution fields back from an HDF5 checkpoint file
+     *
+     * The checkpoint can have been written with a different number of partitions, but not with a
+     * different mesh or number of ensemble members (exits otherwise).
+     *
+     * @param file_name checkpoint file
+     * @return last iteration included in the checkpoint
+     */
+    int restart(const std::string &file_name);
+
+    /*! \brief Publish the residual of each partition into POSIX shared memory
+     *
+     * Each partition writes its elements into the segment /<prefix>_<partition> on the node where
+     * it runs, under a seqlock so that local readers (see ShmReader) can map it without copies or
+     * disk I/O. The segments are removed by clean_up, once the last export is done. Does not
+     * block.
+     *
+     * @param prefix prefix of the segment names
+     * @param iteration current iteration
+     */
+    void publish_shm(const std::string &prefix, const int iteration);
+
+    int nElem; //!< number of elements
+    LegionHandle<Legion::LogicalRegion> elem_lr; //!< element logical region
     Legion::LogicalPartition elem_lp; //!< element logical partition
     Legion::LogicalPartition elem_with_halo_lp; //!< element logical partition with halo
     Legion::Domain domain; //!< partition index domain
+    LegionHandle<Legion::LogicalRegion> trace_lr; //!< face trace logical region
+    Legion::LogicalPartition trace_lp; //!< face trace partition by left element
+    Legion::LogicalPartition trace_R_lp; //!< face trace partition by right element
+    Legion::LogicalPartition trace_all_lp; //!< all faces touching a partition
+    int dim; //!< number of spatial dimensions
+    std::vector<int> bc_type; //!< boundary condition type of each boundary face group
+    int nMember; //!< number of ensemble members, 1 outside of ensemble runs
+
+  private:
+    /*! \brief Face task arguments for the current ensemble
+     *
+     */
+    FaceArgs face_args(const int nIter) const;
+
+    Legion::FieldID face_fid; //!< field receiving the face contributions
+    std::vector<rtype> member_scale; //!< parameter of each ensemble member
+    LegionHandle<Legion::FieldSpace> fs; //!< field space of the solution region
+    LegionHandle<Legion::FieldSpace> trace_fs; //!< field space of the trace region
+    /*! \brief Wait for the last checkpoint or restart and move a written checkpoint into place
+     *
+     */
+    void complete_checkpoint();
+
+    Legion::Future checkpoint_done; //!< completion of the last checkpoint or restart
+    std::string checkpoint_file; //!< checkpoint written to <checkpoint_file>.tmp, if any
+
+    /*! \brief Wait for the last shared-memory export and remove the segments of all partitions
+     *
+     */
+    void unlink_shm();
+
+    Legion::FutureMap shm_exported; //!< completion of the last shared-memory export
+    std::string shm_prefix; //!< prefix of the published segments, if any
 };
 
 #endif //DG_SOLUTION_DATA_H
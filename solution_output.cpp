@@ -0,0 +1,198 @@
+//
+// Created by kihiro on 4/27/20.
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "H5Cpp.h"
+#include "legion.h"
+#include "solution_output.h"
+#include "ids.h"
+#include "redop.h"
+#include "typedefs.h"
+
+using namespace H5;
+using namespace Legion;
+using namespace std;
+
+// identifiers of the output files
+const string DSET_OUTPUT_COORD("coordinates");
+const string DSET_OUTPUT_CONNECTIVITY("connectivity");
+const string DSET_OUTPUT_RESIDUAL("residual");
+
+/*! \brief Strip the directories from a path
+ *
+ * XDMF files refer to the HDF5 files relative to their own location.
+ */
+static string strip_path(const string &path) {
+    size_t pos = path.find_last_of('/');
+    return pos == string::npos ? path : path.substr(pos + 1);
+}
+
+void output_task(const Task *task, const std::vector<PhysicalRegion> &regions,
+                 Context ctx, Runtime *runtime) {
+    OutputArgs args = *(const OutputArgs *)task->args;
+    string prefix(args.prefix);
+    stringstream name;
+    name << prefix << "_" << args.iteration;
+    string h5_name = name.str() + ".h5";
+
+    // gather the staged residual
+    AffAccROstype acc(regions[0], SolutionOutput::FID_OUTPUT_RESIDUAL, N_REDOP*sizeof(stype));
+    Domain domain = runtime->get_index_space_domain(ctx, task->regions[0].region.get_index_space());
+    vector<stype> buff((size_t) args.nElem * N_REDOP);
+    for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+        const stype *ptr = acc.ptr(itr.p);
+        std::copy(ptr, ptr + N_REDOP, buff.begin() + itr.p[0]*N_REDOP);
+    }
+
+    // heavy data
+    {
+        H5File file(h5_name, H5F_ACC_TRUNC);
+        hsize_t dims[2] = {(hsize_t) args.nElem, N_REDOP};
+        DataSpace dataspace(2, dims);
+#if defined(USE_DOUBLES) && !defined(USE_MIXED_PRECISION)
+        DataSet dataset = file.createDataSet(DSET_OUTPUT_RESIDUAL, PredType::NATIVE_DOUBLE,
+            dataspace);
+        dataset.write(buff.data(), PredType::NATIVE_DOUBLE);
+#else
+        DataSet dataset = file.createDataSet(DSET_OUTPUT_RESIDUAL, PredType::NATIVE_FLOAT,
+            dataspace);
+        dataset.write(buff.data(), PredType::NATIVE_FLOAT);
+#endif
+    }
+
+    // light data
+    string mesh_name = strip_path(prefix) + "_mesh.h5";
+    ofstream xmf(name.str() + ".xmf");
+    xmf << "<?xml version=\"1.0\" ?>" << endl
+        << "<Xdmf Version=\"3.0\">" << endl
+        << "  <Domain>" << endl
+        << "    <Grid Name=\"mesh\" GridType=\"Uniform\">" << endl
+        << "      <Time Value=\"" << args.iteration << "\"/>" << endl
+        << "      <Topology TopologyType=\"" << (args.dim == 3 ? "Hexahedron" : "Quadrilateral")
+        << "\" NumberOfElements=\"" << args.nElem << "\">" << endl
+        << "        <DataItem Dimensions=\"" << args.nElem << " " << args.nCorner
+        << "\" NumberType=\"Int\" Format=\"HDF\">" << mesh_name << ":/"
+        << DSET_OUTPUT_CONNECTIVITY << "</DataItem>" << endl
+        << "      </Topology>" << endl
+        << "      <Geometry GeometryType=\"" << (args.dim == 3 ? "XYZ" : "XY") << "\">" << endl
+        << "        <DataItem Dimensions=\"" << args.nNode << " " << args.dim
+        << "\" NumberType=\"Float\" Precision=\"8\" Format=\"HDF\">" << mesh_name << ":/"
+        << DSET_OUTPUT_COORD << "</DataItem>" << endl
+        << "      </Geometry>" << endl
+        << "      <Attribute Name=\"" << DSET_OUTPUT_RESIDUAL
+        << "\" AttributeType=\"Matrix\" Center=\"Cell\">" << endl
+        << "        <DataItem Dimensions=\"" << args.nElem << " " << N_REDOP
+        << "\" NumberType=\"Float\" Precision=\"" << sizeof(stype) << "\" Format=\"HDF\">"
+        << strip_path(h5_name) << ":/" << DSET_OUTPUT_RESIDUAL << "</DataItem>" << endl
+        << "      </Attribute>" << endl
+        << "    </Grid>" << endl
+        << "  </Domain>" << endl
+        << "</Xdmf>" << endl;
+}
+
+void SolutionOutput::register_tasks() {
+    {
+        TaskVariantRegistrar registrar(OUTPUT_TASK_ID, "output_task");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf();
+        Runtime::preregister_task_variant<output_task> (registrar, "output_task");
+    }
+}
+
+SolutionOutput::SolutionOutput(Context ctx, HighLevelRuntime *runtime, Legion::Logger &logger,
+                               const Mesh &mesh, const SolutionData &solution_data_,
+                               const string &prefix, const int max_in_flight) :
+    LegionData(ctx, runtime, logger), solution_data(solution_data_), nDump(0) {
+    if (max_in_flight < 1) {
+        runtime->print_once(ctx, stderr, "Output.in_flight must be at least 1\n");
+        exit(EXIT_FAILURE);
+    }
+    vector<int> corners = mesh.corner_nodes();
+    args.iteration = -1;
+    args.nElem = mesh.nElem;
+    args.nNode = mesh.nNode;
+    args.nCorner = corners.size();
+    args.dim = mesh.dim;
+    strncpy(args.prefix, prefix.c_str(), sizeof(args.prefix) - 1);
+    args.prefix[sizeof(args.prefix) - 1] = '\0';
+
+    // mesh file shared by all snapshots
+    {
+        H5File file(prefix + "_mesh.h5", H5F_ACC_TRUNC);
+        vector<double> coord(mesh.nNode * mesh.dim);
+        for (int iNode=0; iNode<mesh.nNode; iNode++) {
+            for (int idim=0; idim<mesh.dim; idim++) {
+                coord[iNode*mesh.dim + idim] = mesh.coord[iNode][idim];
+            }
+        }
+        hsize_t dims[2] = {(hsize_t) mesh.nNode, (hsize_t) mesh.dim};
+        DataSet dataset = file.createDataSet(DSET_OUTPUT_COORD, PredType::NATIVE_DOUBLE,
+            DataSpace(2, dims));
+        dataset.write(coord.data(), PredType::NATIVE_DOUBLE);
+
+        vector<int> connectivity(mesh.nElem * corners.size());
+        for (int ielem=0; ielem<mesh.nElem; ielem++) {
+            for (size_t i=0; i<corners.size(); i++) {
+                connectivity[ielem*corners.size() + i] =
+                    mesh.eind[mesh.eptr[ielem] + corners[i]];
+            }
+        }
+        dims[0] = mesh.nElem;
+        dims[1] = corners.size();
+        dataset = file.createDataSet(DSET_OUTPUT_CONNECTIVITY, PredType::NATIVE_INT,
+            DataSpace(2, dims));
+        dataset.write(connectivity.data(), PredType::NATIVE_INT);
+    }
+
+    // staging regions
+    fs.reset(ctx, runtime, runtime->create_field_space(ctx));
+    FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
+    allocator.allocate_field(N_REDOP*sizeof(stype), FID_OUTPUT_RESIDUAL);
+    runtime->attach_name(fs, FID_OUTPUT_RESIDUAL, "output_residual");
+
+    staging_lr.resize(max_in_flight);
+    written.resize(max_in_flight);
+    for (int i=0; i<max_in_flight; i++) {
+        staging_lr[i].reset(ctx, runtime, runtime->create_logical_region(ctx,
+            solution_data.elem_lr->get_index_space(), fs));
+        runtime->attach_name(staging_lr[i].get(), "output_staging_logical_region");
+    }
+}
+
+void SolutionOutput::dump(const int iteration) {
+    int slot = nDump % staging_lr.size();
+    nDump++;
+    const LogicalRegion &lr = staging_lr[slot];
+    LogicalPartition lp = runtime->get_logical_partition(ctx, lr,
+        solution_data.elem_lp.get_index_partition());
+
+    // stage the residual, each partition being copied by the DMA system
+    IndexCopyLauncher copy_launcher(solution_data.domain);
+    RegionRequirement src_req(solution_data.elem_lp, 0, READ_ONLY, EXCLUSIVE,
+        solution_data.elem_lr);
+    src_req.add_field(SolutionData::FID_SOL_RESIDUAL);
+    RegionRequirement dst_req(lp, 0, WRITE_DISCARD, EXCLUSIVE, lr);
+    dst_req.add_field(FID_OUTPUT_RESIDUAL);
+    copy_launcher.add_copy_requirements(src_req, dst_req);
+    runtime->issue_copy_operation(ctx, copy_launcher);
+
+    // write in the background
+    args.iteration = iteration;
+    TaskLauncher launcher(OUTPUT_TASK_ID, TaskArgument(&args, sizeof(OutputArgs)));
+    RegionRequirement req(lr, READ_ONLY, EXCLUSIVE, lr);
+    req.add_field(FID_OUTPUT_RESIDUAL);
+    launcher.add_region_requirement(req);
+    written[slot] = runtime->execute_task(ctx, launcher);
+}
+
+void SolutionOutput::wait_all() {
+    for (auto &f: written) {
+        if (f.exists()) f.get_void_result();
+    }
+}
@@ -0,0 +1,88 @@
+//
+// Created by kihiro on 4/27/20.
+//
+
+#ifndef DG_SOLUTION_OUTPUT_H
+#define DG_SOLUTION_OUTPUT_H
+
+#include <string>
+#include <vector>
+#include "legion.h"
+#include "legion_handle.h"
+#include "mesh.h"
+#include "mesh_data.h"
+#include "solution_data.h"
+
+/*! \brief Arguments of the output task
+ *
+ */
+struct OutputArgs {
+    int iteration; //!< iteration being written
+    int nElem; //!< number of elements
+    int nNode; //!< number of nodes
+    int nCorner; //!< number of corner nodes per element
+    int dim; //!< number of spatial dimensions
+    char prefix[256]; //!< prefix of the output files
+};
+
+/*! \brief Asynchronous output of the residual field
+ *
+ * Each dump copies the residual into a staging region and launches a task that writes it to an
+ * HDF5 file described by an XDMF file. The copy is done by the DMA system and the write happens in
+ * the background, so the next iterations can start right away. Staging regions are reused in a
+ * round-robin fashion: Legion orders the copy into a staging region after the previous write out of
+ * it, which bounds the number of snapshots in flight and the memory they use.
+ */
+class SolutionOutput : public LegionData {
+  public:
+    /*! \brief Output regions' fields
+     *
+     */
+    enum FieldIDs {
+        FID_OUTPUT_RESIDUAL, //!< staged copy of the residual
+    };
+
+    /*! \brief Pre-register the output task
+     *
+     */
+    static void register_tasks();
+
+    /*! \brief Constructor
+     *
+     * Write the mesh file referenced by all snapshots and create the staging regions.
+     *
+     * @param ctx Legion's context
+     * @param runtime Legion's runtime
+     * @param logger
+     * @param mesh mesh object
+     * @param solution_data solution regions
+     * @param prefix prefix of the output files
+     * @param max_in_flight number of staging regions, at least 1 (exits otherwise)
+     */
+    SolutionOutput(Legion::Context ctx, Legion::HighLevelRuntime *runtime, Legion::Logger &logger,
+        const Mesh &mesh, const SolutionData &solution_data, const std::string &prefix,
+        const int max_in_flight);
+
+    /*! \brief Dump the residual
+     *
+     * Does not block.
+     *
+     * @param iteration current iteration
+     */
+    void dump(const int iteration);
+
+    /*! \brief Wait for all dumps to be written
+     *
+     */
+    void wait_all();
+
+  private:
+    const SolutionData &solution_data; //!< solution regions
+    OutputArgs args; //!< arguments shared by all dumps
+    int nDump; //!< number of dumps issued
+    LegionHandle<Legion::FieldSpace> fs; //!< field space of the staging regions
+    std::vector<LegionHandle<Legion::LogicalRegion>> staging_lr; //!< staging regions
+    std::vector<Legion::Future> written; //!< last write out of each staging region
+};
+
+#endif //DG_SOLUTION_OUTPUT_H
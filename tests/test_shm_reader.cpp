@@ -0,0 +1,173 @@
+//
+// Created by kihiro on 5/4/20.
+//
+
+#include <unistd.h>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "shm_reader.h"
+#include "shm_segment.h"
+
+using namespace std;
+
+static int nFailure = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        nFailure++; \
+    } \
+} while (0)
+
+/*! \brief Publish nElem elements whose values all equal value, like shm_export_task
+ *
+ */
+template <typename T>
+static void publish(ShmSegment &segment, const int iteration, const int nElem, const int nValue,
+                    const T value) {
+    segment.begin_write();
+    ShmHeader *header = segment.header();
+    header->iteration = iteration;
+    header->partition = 3;
+    header->nElem = nElem;
+    header->nValue = nValue;
+    header->value_size = sizeof(T);
+    header->elem_lo = 10;
+    header->elem_hi = 10 + nElem - 1;
+    int64_t *elem_ids = segment.elem_ids();
+    T *values = (T *) segment.values(nElem);
+    for (int i=0; i<nElem; i++) {
+        elem_ids[i] = 10 + i;
+        for (int k=0; k<nValue; k++) values[i*nValue + k] = value;
+    }
+    segment.end_write();
+}
+
+/*! \brief Every element ID and value of a snapshot matches what publish wrote
+ *
+ */
+static bool consistent(const ShmSnapshot &snapshot, const int nElem, const int nValue,
+                       const double value) {
+    if (snapshot.elem_ids.size() != (size_t) nElem) return false;
+    if (snapshot.values.size() != (size_t) nElem*nValue) return false;
+    for (int i=0; i<nElem; i++) {
+        if (snapshot.elem_ids[i] != 10 + i) return false;
+    }
+    for (auto v: snapshot.values) {
+        if (v != value) return false;
+    }
+    return true;
+}
+
+static void test_round_trip(const string &prefix) {
+    const int nElem = 7, nValue = 5;
+    string name = ShmSegment::name(prefix, 3);
+    {
+        ShmSegment segment(name, ShmSegment::size(nElem, nValue, sizeof(double)));
+        CHECK(segment.valid());
+        publish<double>(segment, 42, nElem, nValue, 0.125);
+    }
+
+    ShmReader reader(prefix, 3);
+    ShmSnapshot snapshot;
+    CHECK(reader.read(snapshot));
+    CHECK(snapshot.iteration == 42);
+    CHECK(snapshot.partition == 3);
+    CHECK(snapshot.nValue == nValue);
+    CHECK(snapshot.elem_lo == 10);
+    CHECK(snapshot.elem_hi == 10 + nElem - 1);
+    CHECK(consistent(snapshot, nElem, nValue, 0.125));
+
+    // single precision values (mixed precision builds), in a segment grown after the first read
+    {
+        ShmSegment segment(name, ShmSegment::size(4*nElem, nValue, sizeof(float)));
+        CHECK(segment.valid());
+        publish<float>(segment, 43, 4*nElem, nValue, 0.5f);
+    }
+    CHECK(reader.read(snapshot));
+    CHECK(snapshot.iteration == 43);
+    CHECK(consistent(snapshot, 4*nElem, nValue, 0.5));
+
+    // once removed, the segment cannot be opened again
+    ShmSegment::unlink(name);
+    ShmReader removed(prefix, 3);
+    CHECK(!removed.read(snapshot, 3));
+}
+
+static void test_missing_segment(const string &prefix) {
+    ShmReader reader(prefix + "_missing", 0);
+    ShmSnapshot snapshot;
+    CHECK(!reader.read(snapshot, 3));
+}
+
+static void test_torn_write(const string &prefix) {
+    const int nElem = 4096, nValue = 4;
+    string name = ShmSegment::name(prefix, 3);
+    ShmSegment segment(name, ShmSegment::size(nElem, nValue, sizeof(double)));
+    CHECK(segment.valid());
+    publish<double>(segment, 1, nElem, nValue, 1.);
+
+    // a writer stopped in the middle of an update leaves an odd sequence number behind
+    segment.begin_write();
+    segment.header()->iteration = 2;
+    ShmReader reader(prefix, 3);
+    ShmSnapshot snapshot;
+    CHECK(!reader.read(snapshot, 10));
+
+    // the next writer recovers from it
+    publish<double>(segment, 3, nElem, nValue, 3.);
+    CHECK(segment.header()->sequence.load() % 2 == 0);
+    CHECK(reader.read(snapshot));
+    CHECK(snapshot.iteration == 3);
+    CHECK(consistent(snapshot, nElem, nValue, 3.));
+
+    // a reader racing with a writer either retries or gets a consistent snapshot, never a mix of
+    // two updates, while the number of elements changes under its feet (odd iterations publish
+    // half of the elements, iteration 3 above excepted)
+    const int nIter = 20000;
+    atomic<bool> done(false);
+    thread writer([&]() {
+        ShmSegment w(name, ShmSegment::size(nElem, nValue, sizeof(double)));
+        for (int it=4; it<nIter; it++) {
+            publish<double>(w, it, it%2 == 0 ? nElem : nElem/2, nValue, (double) it);
+        }
+        done = true;
+    });
+    int nSuccess = 0, nMixed = 0;
+    while (!done) {
+        if (reader.read(snapshot, 100)) {
+            nSuccess++;
+            int n = snapshot.iteration%2 == 0 || snapshot.iteration == 3 ? nElem : nElem/2;
+            if (!consistent(snapshot, n, nValue, snapshot.iteration)) nMixed++;
+        }
+    }
+    writer.join();
+    CHECK(nMixed == 0);
+    CHECK(reader.read(snapshot));
+    CHECK(snapshot.iteration == nIter - 1);
+    printf("racing reads: %d consistent snapshots, %d mixed\n", nSuccess, nMixed);
+
+    ShmSegment::unlink(name);
+}
+
+int main() {
+    stringstream ss;
+    ss << "dg_test_shm_" << getpid();
+    string prefix = ss.str();
+
+    test_round_trip(prefix);
+    test_missing_segment(prefix);
+    test_torn_write(prefix);
+
+    if (nFailure > 0) {
+        printf("%d checks failed\n", nFailure);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
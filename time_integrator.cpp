@@ -0,0 +1,132 @@
+//
+// Created by kihiro on 6/1/20.
+//
+
+#include <cstdlib>
+#include <vector>
+#include "legion.h"
+#include "time_integrator.h"
+#include "ids.h"
+#include "redop.h"
+#include "typedefs.h"
+
+using namespace Legion;
+using namespace LegionRuntime;
+using namespace std;
+
+void rk_update_task(const Task *task, const std::vector<PhysicalRegion> &regions,
+                    Context ctx, Runtime *runtime) {
+    RKArgs arg = *(const RKArgs *)task->args;
+    const AffAccRWrtype acc_u(regions[0], SolutionData::FID_SOL_STATE, N_REDOP*sizeof(rtype));
+    const AffAccRWstype acc_res(regions[0], SolutionData::FID_SOL_RESIDUAL, N_REDOP*sizeof(stype));
+    const AffAccRWrtype acc_reg(regions[0], SolutionData::FID_SOL_REGISTER, N_REDOP*sizeof(rtype));
+
+    Domain domain = runtime->get_index_space_domain(ctx, task->regions[0].region.get_index_space());
+    for (Domain::DomainPointIterator itr(domain); itr; itr++) {
+        rtype *u = acc_u.ptr(itr.p);
+        stype *res = acc_res.ptr(itr.p);
+        rtype *reg = acc_reg.ptr(itr.p);
+        if (arg.derivative) {
+            for (int k=0; k<N_REDOP; k++) {
+                // the register holds garbage before the first stage
+                reg[k] = arg.c_reg == 0. ? (rtype) res[k] : arg.c_reg*reg[k] + res[k];
+                u[k] = arg.c_u*u[k] + arg.c_res*reg[k];
+                res[k] = arg.c_next*reg[k];
+            }
+        }
+        else {
+            for (int k=0; k<N_REDOP; k++) {
+                if (arg.save) reg[k] = u[k];
+                u[k] = arg.c_u0*reg[k] + arg.c_u*u[k] + arg.c_res*res[k];
+                res[k] *= arg.c_next;
+            }
+        }
+    }
+}
+
+void TimeIntegrator::register_tasks() {
+    TaskVariantRegistrar registrar(RK_UPDATE_TASK_ID, "rk_update_task");
+    registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+    registrar.set_leaf();
+    Runtime::preregister_task_variant<rk_update_task> (registrar, "rk_update_task");
+}
+
+TimeIntegrator::TimeIntegrator(Context ctx, HighLevelRuntime *runtime, Legion::Logger &logger,
+                               SolutionData &solution_data_, const string &scheme,
+                               const rtype dt_) :
+    LegionData(ctx, runtime, logger), dt(dt_), time(0.), solution_data(solution_data_) {
+    // the register is written by the first stage of either scheme before being read
+    solution_data.use_state();
+    solution_data.allocate_field(SolutionData::FID_SOL_REGISTER, "sol_register");
+    if (scheme == "ssprk3") {
+        // U1 = U0 + dt R(U0), U2 = 3/4 U0 + 1/4 (U1 + dt R(U1)), U = 1/3 U0 + 2/3 (U2 + dt R(U2))
+        const rtype c_u0[3] = {0., 0.75, 1./3.};
+        const rtype c_u[3] = {1., 0.25, 2./3.};
+        for (int i=0; i<3; i++) {
+            RKArgs arg;
+            arg.save = i==0;
+            arg.derivative = 0;
+            arg.c_u0 = c_u0[i];
+            arg.c_u = c_u[i];
+            arg.c_res = c_u[i]*dt;
+            arg.c_next = i<2 ? 0. : 1.;
+            arg.c_reg = 0.;
+            stages.push_back(arg);
+        }
+    }
+    else if (scheme == "lsrk4") {
+        // Carpenter and Kennedy (1994), five-stage fourth order 2N-storage scheme, the register
+        // holds dU/dt: D = A_i D + R(U), U = U + B_i dt D, the residual is cleared for the next
+        // stage
+        const double A[5] = {0.,
+                             -567301805773.0/1357537059087.0,
+                             -2404267990393.0/2016746695238.0,
+                             -3550918686646.0/2091501179385.0,
+                             -1275806237668.0/842570457699.0};
+        const double B[5] = {1432997174477.0/9575080441755.0,
+                             5161836677717.0/13612068292357.0,
+                             1720146321549.0/2090206949498.0,
+                             3134564353537.0/4481467310338.0,
+                             2277821191437.0/14882151754819.0};
+        for (int i=0; i<5; i++) {
+            RKArgs arg;
+            arg.save = 0;
+            arg.derivative = 1;
+            arg.c_u0 = 0.;
+            arg.c_u = 1.;
+            arg.c_res = (rtype) (B[i]*dt);
+            arg.c_next = i<4 ? 0. : 1.;
+            arg.c_reg = (rtype) A[i];
+            stages.push_back(arg);
+        }
+    }
+    else {
+        runtime->print_once(ctx, stderr,
+            ("Unknown time integration scheme " + scheme + "\n").c_str());
+        exit(EXIT_FAILURE);
+    }
+}
+
+void TimeIntegrator::step(const function<void(const Predicate &)> &residual,
+                          const Predicate &pred) {
+    // the residual field is reset by a fill, the stage updates then keep it ready for the next
+    // stage (zeroed or scaled in place)
+    solution_data.fill_field(SolutionData::FID_SOL_RESIDUAL, 0., pred);
+
+    for (auto &stage: stages) {
+        residual(pred);
+        update(stage, pred);
+    }
+    time += dt;
+}
+
+void TimeIntegrator::update(const RKArgs &arg, const Predicate &pred) {
+    IndexLauncher index_launcher(RK_UPDATE_TASK_ID, solution_data.domain,
+        TaskArgument(&arg, sizeof(RKArgs)), ArgumentMap(), pred);
+    RegionRequirement req(solution_data.elem_lp, 0, READ_WRITE, EXCLUSIVE, solution_data.elem_lr);
+    req.add_field(SolutionData::FID_SOL_STATE);
+    req.add_field(SolutionData::FID_SOL_RESIDUAL);
+    req.add_field(SolutionData::FID_SOL_REGISTER);
+    index_launcher.add_region_requirement(req);
+    runtime->execute_index_space(ctx, index_launcher);
+}
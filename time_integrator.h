@@ -0,0 +1,89 @@
+//
+// Created by kihiro on 6/1/20.
+//
+
+#ifndef DG_TIME_INTEGRATOR_H
+#define DG_TIME_INTEGRATOR_H
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "legion.h"
+#include "mesh_data.h"
+#include "solution_data.h"
+
+/*! \brief Coefficients of one fused Runge-Kutta stage update
+ *
+ * U = c_u0*U0 + c_u*U + c_res*R, then R = c_next*R. U0 is the register of the scheme, saved from U
+ * before the update when save is set.
+ *
+ * 2N-storage schemes set derivative instead: the register D accumulates the stage derivative,
+ * D = c_reg*D + R, then U = c_u*U + c_res*D and R = c_next*D.
+ */
+struct RKArgs {
+    int save; //!< copy the state into the register before the update
+    int derivative; //!< the register holds the stage derivative (2N-storage schemes)
+    rtype c_u0; //!< weight of the register
+    rtype c_u; //!< weight of the state
+    rtype c_res; //!< weight of the residual, or of the derivative (includes the time step)
+    rtype c_next; //!< scaling of the residual, or of the derivative, for the next stage
+    rtype c_reg; //!< weight of the derivative in its own update
+};
+
+/*! \brief Explicit low-storage Runge-Kutta time integration of the solution state
+ *
+ * The residual evaluations accumulate into FID_SOL_RESIDUAL, which is reset at the start of each
+ * step. Each stage then costs the residual launches plus a single fused update task per partition.
+ * Two schemes are available:
+ * - "ssprk3": three-stage strong stability preserving scheme (Shu-Osher form), which needs the
+ *   state, FID_SOL_REGISTER holding the state at the beginning of the step and the residual;
+ * - "lsrk4": five-stage fourth order 2N-storage scheme of Carpenter and Kennedy, in which
+ *   FID_SOL_REGISTER holds the stage derivative. It is stored as rtype, whereas the residual field
+ *   may be single precision (mixed precision builds) and would round it at every stage.
+ *
+ * After a step, the residual field holds the last stage's residual (ssprk3) or the last derivative
+ * (lsrk4), so convergence monitoring and output keep working on it.
+ */
+class TimeIntegrator : public LegionData {
+  public:
+    /*! \brief Pre-register all time integration related tasks
+     *
+     */
+    static void register_tasks();
+
+    /*! \brief Constructor
+     *
+     * @param ctx Legion's context
+     * @param runtime Legion's runtime
+     * @param logger
+     * @param solution_data solution regions holding the state
+     * @param scheme "ssprk3" or "lsrk4", exits on any other name
+     * @param dt time step
+     */
+    TimeIntegrator(Legion::Context ctx, Legion::HighLevelRuntime *runtime, Legion::Logger &logger,
+                   SolutionData &solution_data, const std::string &scheme, const rtype dt);
+
+    /*! \brief Advance the state by one time step
+     *
+     * Does not block.
+     *
+     * @param residual issues the launches accumulating the residual of the current state
+     * @param pred predicate guarding every launch of the step
+     */
+    void step(const std::function<void(const Legion::Predicate &)> &residual,
+              const Legion::Predicate &pred = Legion::Predicate::TRUE_PRED);
+
+    rtype dt; //!< time step
+    rtype time; //!< physical time reached by the issued steps
+
+  private:
+    /*! \brief Launch the fused stage update
+     *
+     */
+    void update(const RKArgs &arg, const Legion::Predicate &pred);
+
+    SolutionData &solution_data; //!< solution regions
+    std::vector<RKArgs> stages; //!< update coefficients of each stage, time step included
+};
+
+#endif //DG_TIME_INTEGRATOR_H
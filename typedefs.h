@@ -72,6 +72,22 @@ typedef Legion::FieldAccessor< WRITE_DISCARD, rtype, 1, Legion::coord_t,
 typedef Legion::FieldAccessor< REDUCE, rtype, 1, Legion::coord_t,
     Realm::AffineAccessor<rtype, 1, Legion::coord_t> > AffAccREDrtype;
 
+/*! \brief Affine read-only accessor for stype data
+ *
+ */
+typedef Legion::FieldAccessor< READ_ONLY, stype, 1, Legion::coord_t,
+    Realm::AffineAccessor<stype, 1, Legion::coord_t> > AffAccROstype;
+/*! \brief Affine read-write accessor for stype data
+ *
+ */
+typedef Legion::FieldAccessor< READ_WRITE, stype, 1, Legion::coord_t,
+    Realm::AffineAccessor<stype, 1, Legion::coord_t> > AffAccRWstype;
+/*! \brief Affine write-discard accessor for stype data
+ *
+ */
+typedef Legion::FieldAccessor< WRITE_DISCARD, stype, 1, Legion::coord_t,
+    Realm::AffineAccessor<stype, 1, Legion::coord_t> > AffAccWDstype;
+
 /*! \brief Affine read-write accessor for int data
  *
  */
@@ -105,4 +121,16 @@ typedef Legion::FieldAccessor< READ_ONLY, Legion::Point<1>, 1, Legion::coord_t,
 typedef Legion::FieldAccessor< WRITE_DISCARD, Legion::Point<1>, 1, Legion::coord_t,
     Realm::AffineAccessor<Legion::Point<1>, 1, Legion::coord_t> > AffAccWDPoint1;
 
+/*! \brief Affine read-only accessor for Rect<1> data
+ *
+ */
+typedef Legion::FieldAccessor< READ_ONLY, Legion::Rect<1>, 1, Legion::coord_t,
+    Realm::AffineAccessor<Legion::Rect<1>, 1, Legion::coord_t> > AffAccRORect1;
+
+/*! \brief Affine write-discard accessor for Rect<1> data
+ *
+ */
+typedef Legion::FieldAccessor< WRITE_DISCARD, Legion::Rect<1>, 1, Legion::coord_t,
+    Realm::AffineAccessor<Legion::Rect<1>, 1, Legion::coord_t> > AffAccWDRect1;
+
 #endif //DG_TYPEDEFS_H
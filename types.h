@@ -12,4 +12,15 @@ typedef double rtype;
 typedef float rtype;
 #endif
 
+// storage type of the residual fields, single precision in mixed precision builds while the
+// computations stay in rtype
+#ifdef USE_MIXED_PRECISION
+#ifndef USE_DOUBLES
+#error "USE_MIXED_PRECISION requires USE_DOUBLES"
+#endif
+typedef float stype;
+#else
+typedef rtype stype;
+#endif
+
 #endif //DG_TYPES_H